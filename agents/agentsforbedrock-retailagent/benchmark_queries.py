@@ -0,0 +1,93 @@
+"""
+Latency of the /customer/{CustomerName} and /check_inventory queries of csbot_agent.py on a copy of demo_csbot_db
+scaled to N customers, comparing the previous queries (LIKE built by string concatenation, ShoeInventory read on
+every call) with the trigram name index and the inventory snapshot:
+
+    python benchmark_queries.py --customers 1000000
+
+No AWS access is needed: BUCKET_NAME is left unset so csbot_agent does not download anything.
+"""
+import os
+import sys
+import time
+import random
+import shutil
+import sqlite3
+import argparse
+import statistics
+
+DATA_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "data", "demo_csbot_db")
+FIRST_NAMES = ["John", "Jane", "Bob", "Sue", "Mike", "Mary", "Jeff", "Lisa", "Bill", "Sara", "Omar", "Priya", "Wei", "Elena", "Kofi"]
+LAST_NAMES = ["Doe", "Smith", "Johnson", "Brown", "Davis", "Miller", "Wilson", "Garcia", "Taylor", "Anderson", "Nguyen", "Okafor"]
+
+
+def build_database(db_file, customers):
+    shutil.copy(DATA_FILE, db_file)
+    conn = sqlite3.connect(db_file)
+    rng = random.Random(0)
+    rows = ((f"{rng.choice(FIRST_NAMES)} {rng.choice(LAST_NAMES)}-{i}", f"{i} Main St", None, "Chicago", "IL", "60601",
+             rng.choice(["Running", "Hiking", "Walking", "Casual"]), 9, "") for i in range(customers))
+    conn.executemany("INSERT INTO CustomerInfo (CustomerName, Addr1, Addr2, City, State, Zipcode, PreferredActivity, ShoeSize, OtherInfo)"
+                     " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", rows)
+    conn.commit()
+    conn.close()
+
+
+def previous_customer_info(cursor, custName):
+    query = 'SELECT customerId, customerName, Addr1, Addr2, City, State, Zipcode, PreferredActivity, ShoeSize, OtherInfo from CustomerInfo where customerName like "%' +  custName +'%"'
+    cursor.execute(query)
+    return cursor.fetchall()[0]
+
+
+def previous_shoe_inventory(cursor):
+    cursor.execute('SELECT ShoeID, BestFitActivity, StyleDesc, ShoeColors, Price, InvCount from ShoeInventory')
+    names = [description[0] for description in cursor.description]
+    return [dict(zip(names, item)) for item in cursor.fetchall()]
+
+
+def measure(fn, args_list):
+    latencies = []
+    for args in args_list:
+        st = time.perf_counter()
+        fn(*args)
+        latencies.append((time.perf_counter() - st) * 1000)
+    latencies.sort()
+    return statistics.mean(latencies), latencies[int(len(latencies) * 0.99) - 1]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--customers", type=int, default=1_000_000)
+    parser.add_argument("--lookups", type=int, default=200)
+    parser.add_argument("--db", default="/tmp/csbot-benchmark.db")
+    args = parser.parse_args()
+
+    print(f"building {args.db} with {args.customers} extra customers")
+    build_database(args.db, args.customers)
+    os.environ.pop("BUCKET_NAME", None)
+    os.environ["LOCAL_DB"] = args.db
+    os.environ["PERSISTENCE_MODE"] = "snapshot"  # no event sync, nothing touches S3
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    import csbot_agent
+
+    st = time.perf_counter()
+    csbot_agent.cursor = csbot_agent.load_data()
+    print(f"first load_data (builds the trigram index): {time.perf_counter() - st:.2f}s, name index={csbot_agent.name_index}")
+
+    rng = random.Random(1)
+    # the agent passes whatever name the user typed: full names, last names, names with the id suffix
+    names = [(rng.choice([f"{rng.choice(FIRST_NAMES)} {rng.choice(LAST_NAMES)}", rng.choice(LAST_NAMES),
+                          f"-{rng.randrange(args.customers)}"]),) for _ in range(args.lookups)]
+    results = {
+        "customer (LIKE scan)": measure(lambda n: previous_customer_info(csbot_agent.cursor, n), names),
+        "customer (trigram)": measure(csbot_agent.return_customer_info, names),
+        "inventory (query)": measure(lambda: previous_shoe_inventory(csbot_agent.cursor), [()] * 1000),
+        "inventory (snapshot)": measure(csbot_agent.return_shoe_inventory, [()] * 1000),
+    }
+    print(f"\n{'query':<24}{'mean ms':>10}{'p99 ms':>10}")
+    for name, (mean, p99) in results.items():
+        print(f"{name:<24}{mean:>10.3f}{p99:>10.3f}")
+
+
+if __name__ == "__main__":
+    main()
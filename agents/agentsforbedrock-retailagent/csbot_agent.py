@@ -1,11 +1,15 @@
 
 import json
 import boto3
+from botocore.exceptions import ClientError
 import sqlite3
 from datetime import datetime
 import random
 import logging
 import os
+import re
+import time
+import uuid
 
 logger = logging.getLogger()
 logger.setLevel(logging.INFO)
@@ -13,29 +17,131 @@ logger.setLevel(logging.INFO)
 s3 = boto3.client('s3')
 bucket = os.environ.get('BUCKET_NAME')  #Name of bucket with data file and OpenAPI file
 db_name = 'demo_csbot_db' #Location of data file in S3
-local_db = '/tmp/csbot.db' #Location in Lambda /tmp folder where data file will be copied
-
-#Download data file from S3
-s3.download_file(bucket, db_name, local_db)
+local_db = os.environ.get('LOCAL_DB', '/tmp/csbot.db') #Location in Lambda /tmp folder where data file will be copied
+#'eventlog' writes each order to S3 as a small event object, 'snapshot' uploads the whole data file after every order
+persistence_mode = os.environ.get('PERSISTENCE_MODE', 'eventlog')
+events_prefix = db_name + '.events/' #Location in S3 of the order events not yet compacted into the data file
+compact_after_events = int(os.environ.get('COMPACT_AFTER_EVENTS', '200')) #Upload a new data file once this many events are compactable
+sync_interval_seconds = float(os.environ.get('SYNC_INTERVAL_SECONDS', '5')) #How often a warm Lambda picks up orders placed by other Lambdas before placing one
+#Events are listed again for this long so ones written late by concurrent Lambdas (clock skew, slow puts) are not missed.
+#Must be longer than the function timeout and than SYNC_INTERVAL_SECONDS.
+event_window_seconds = 300
 
 cursor = None
 conn = None
+last_sync = 0
+name_index = False #Whether CustomerNameIndex can be used, the trigram tokenizer needs SQLite 3.34 or later
+inventory_snapshot = None #ShoeInventory as returned by /check_inventory, reset whenever an order changes the table
+data_etag = None #ETag of the S3 data file the local copy was downloaded from or uploaded as
+
+def save_etag(etag):
+    global data_etag
+    data_etag = etag
+    #Kept next to the data file so a restarted runtime in the same execution environment can revalidate its /tmp copy
+    with open(local_db + '.etag', 'w') as f:
+        f.write(etag)
+
+#Downloads the data file unless the local copy is still current, returns True when the local copy was replaced
+def refresh_data_file():
+    global data_etag
+    if data_etag is None and os.path.exists(local_db) and os.path.exists(local_db + '.etag'):
+        with open(local_db + '.etag') as f:
+            data_etag = f.read()
+    try:
+        if data_etag is None:
+            resp = s3.get_object(Bucket=bucket, Key=db_name)
+        else:
+            #Conditional GET, S3 answers 304 without a body when the data file has not changed
+            resp = s3.get_object(Bucket=bucket, Key=db_name, IfNoneMatch=data_etag)
+    except ClientError as e:
+        if e.response['Error']['Code'] in ('304', 'NotModified'):
+            return False
+        raise
+    with open(local_db + '.download', 'wb') as f:
+        for chunk in resp['Body'].iter_chunks(1024 * 1024):
+            f.write(chunk)
+    os.replace(local_db + '.download', local_db)
+    save_etag(resp['ETag'])
+    logger.info('Downloaded data file')
+    return True
+
+#Uploads the local copy unless another Lambda uploaded the data file since this copy was downloaded, returns False then
+def upload_data_file():
+    #Conditional PUT on the ETag the copy came from, so a stale copy can never overwrite a newer data file
+    condition = {'IfMatch': data_etag} if data_etag else {}
+    try:
+        with open(local_db, 'rb') as f:
+            resp = s3.put_object(Bucket=bucket, Key=db_name, Body=f, **condition)
+    except ClientError as e:
+        if e.response['Error']['Code'] in ('412', 'PreconditionFailed', 'ConditionalRequestConflict'):
+            logger.info('Data file changed in S3 since it was downloaded, not uploading')
+            return False
+        raise
+    #The local copy is now what S3 has, the next revalidation gets a 304
+    save_etag(resp['ETag'])
+    return True
+
+#Download data file from S3 unless the copy in /tmp is still current (BUCKET_NAME is not set when the module is used locally)
+if bucket:
+    refresh_data_file()
 
 #Initial data load and SQLite3 cursor creation 
 def load_data():
     #load SQL Lite database from S3
     # create the db
     global conn
-    conn = sqlite3.connect(local_db)
+    global name_index
+    global inventory_snapshot
+    if conn is not None:
+        conn.close()
+    #Queries are parameterized, so sqlite3 prepares each one once per connection and reuses it from its statement cache
+    conn = sqlite3.connect(local_db, cached_statements=64)
     cursor = conn.cursor()
+    name_index = create_customer_name_index(cursor)
+    inventory_snapshot = None
+    if persistence_mode == 'eventlog':
+        #Keys of the events already applied to the local data file, uploaded with it on compaction
+        cursor.execute('CREATE TABLE IF NOT EXISTS AppliedEvents (EventKey VARCHAR(100) PRIMARY KEY)')
+        conn.commit()
+        sync_events(cursor)
     logger.info('Completed initial data load ')
 
     return cursor
     
+#Trigram full text index over CustomerInfo.CustomerName, answers LIKE '%name%' without scanning the table.
+#Built once and kept in the data file, so it is uploaded and downloaded with it. Returns False when SQLite has no trigram tokenizer.
+def create_customer_name_index(cursor):
+    cursor.execute("SELECT 1 FROM sqlite_master WHERE name = 'CustomerNameIndex'")
+    if cursor.fetchone() is not None:
+        return True
+    try:
+        cursor.execute("CREATE VIRTUAL TABLE CustomerNameIndex USING fts5(CustomerName, content='CustomerInfo', content_rowid='CustomerID', tokenize='trigram')")
+        cursor.execute("INSERT INTO CustomerNameIndex(CustomerNameIndex) VALUES ('rebuild')")
+        #Keep the index in sync with CustomerInfo
+        cursor.execute("""CREATE TRIGGER CustomerInfo_ai AFTER INSERT ON CustomerInfo BEGIN
+            INSERT INTO CustomerNameIndex(rowid, CustomerName) VALUES (new.CustomerID, new.CustomerName); END""")
+        cursor.execute("""CREATE TRIGGER CustomerInfo_ad AFTER DELETE ON CustomerInfo BEGIN
+            INSERT INTO CustomerNameIndex(CustomerNameIndex, rowid, CustomerName) VALUES ('delete', old.CustomerID, old.CustomerName); END""")
+        cursor.execute("""CREATE TRIGGER CustomerInfo_au AFTER UPDATE OF CustomerName ON CustomerInfo BEGIN
+            INSERT INTO CustomerNameIndex(CustomerNameIndex, rowid, CustomerName) VALUES ('delete', old.CustomerID, old.CustomerName);
+            INSERT INTO CustomerNameIndex(rowid, CustomerName) VALUES (new.CustomerID, new.CustomerName); END""")
+        conn.commit()
+        logger.info('Created customer name index')
+        return True
+    except sqlite3.OperationalError as e:
+        conn.rollback()
+        logger.info('No customer name index, searching with LIKE: ' + str(e))
+        return False
+
 #Function returns all customer info for a particular customerId
 def return_customer_info(custName):
-    query = 'SELECT customerId, customerName, Addr1, Addr2, City, State, Zipcode, PreferredActivity, ShoeSize, OtherInfo from CustomerInfo where customerName like "%' +  custName +'%"'
-    cursor.execute(query)
+    columns = 'customerId, customerName, Addr1, Addr2, City, State, Zipcode, PreferredActivity, ShoeSize, OtherInfo'
+    if name_index and len(custName) >= 3:
+        #The trigram index needs at least 3 characters, shorter names fall back to the scan
+        query = 'SELECT ' + columns + ' from CustomerInfo where CustomerID = (SELECT rowid FROM CustomerNameIndex WHERE CustomerName like ? order by rowid limit 1)'
+    else:
+        query = 'SELECT ' + columns + ' from CustomerInfo where customerName like ? limit 1'
+    cursor.execute(query, ('%' + custName + '%',))
     resp = cursor.fetchall()
     #adding column names to response values
     names = [description[0] for description in cursor.description]
@@ -50,6 +156,10 @@ def return_customer_info(custName):
     
 #Function returns shoe inventory for a particular shoeid 
 def return_shoe_inventory():
+    global inventory_snapshot
+    if inventory_snapshot is not None:
+        logger.info('Shoe info retrieved')
+        return inventory_snapshot
     query = 'SELECT ShoeID, BestFitActivity, StyleDesc, ShoeColors, Price, InvCount from ShoeInventory' 
     cursor.execute(query)
     resp = cursor.fetchall()
@@ -66,28 +176,171 @@ def return_shoe_inventory():
         index = 0
         valDict.append(interimDict)
         interimDict={}
+    inventory_snapshot = valDict
     logger.info('Shoe info retrieved')
     return valDict
 
     
-#function places order -- reduces shoe inventory, updates order_details table --> all actions resulting from a shoe purchase  
-def place_shoe_order(ssId, custId):
+#Applies an order to the local data file, the caller commits
+def apply_order(cursor, ssId, custId, orderDate, quantity=1):
+    global inventory_snapshot
+    inventory_snapshot = None
+    cursor.execute('Update ShoeInventory set InvCount = InvCount - ? where ShoeID = ?', (quantity, ssId))
+    #One OrderDetails row per shoe, like an order placed through /place_order
+    cursor.executemany('INSERT INTO OrderDetails (orderdate, shoeId, CustomerId) VALUES (?, ?, ?)', [(orderDate, ssId, custId)] * quantity)
+
+
+#Event keys sort by the time they were written, so listing from a key returns everything written after it
+def event_key(ns):
+    return events_prefix + '%020d' % ns
+
+
+#Applies the order events written to S3 by any Lambda that are not in the local data file yet, returns how many were applied
+def sync_events(cursor):
+    global last_sync
+    cursor.execute('SELECT max(EventKey) FROM AppliedEvents')
+    latest = cursor.fetchone()[0]
+    start_after = ''
+    if latest:
+        latest_ns = int(latest[len(events_prefix):].split('-')[0])
+        start_after = event_key(latest_ns - event_window_seconds * 10**9)
+    applied = 0
+    for page in s3.get_paginator('list_objects_v2').paginate(Bucket=bucket, Prefix=events_prefix, StartAfter=start_after):
+        for obj in page.get('Contents', []):
+            cursor.execute('INSERT OR IGNORE INTO AppliedEvents (EventKey) VALUES (?)', (obj['Key'],))
+            if cursor.rowcount == 0:
+                continue
+            event = json.loads(s3.get_object(Bucket=bucket, Key=obj['Key'])['Body'].read())
+            #Single shoe events were written before /place_orders existed
+            for item in event.get('Items', [{'ShoeID': event.get('ShoeID'), 'Quantity': 1}]):
+                apply_order(cursor, item['ShoeID'], event['CustomerID'], event['OrderDate'], item['Quantity'])
+            applied = applied + 1
+    conn.commit()
+    last_sync = time.monotonic()
+    if applied:
+        logger.info('Applied ' + str(applied) + ' order events')
+    return applied
+
+
+#Picks up the data file another Lambda compacted, whose deleted events this copy cannot sync any more, then the events
+def refresh_and_sync():
     global cursor
-    global conn
-    query = 'Update ShoeInventory set InvCount = InvCount - 1 where ShoeID = ' + str(ssId)
-    ret = cursor.execute(query)
-    
-    today = datetime.today().strftime('%Y-%m-%d')
-    query = 'INSERT INTO OrderDetails (orderdate, shoeId, CustomerId) VALUES ("'+today+'",'+str(ssId)+','+ str(custId)+')'
-    ret = cursor.execute(query)
+    if refresh_data_file():
+        cursor = load_data()
+    else:
+        sync_events(cursor)
+
+
+#Uploads the local data file with every event applied so far, then deletes the events it makes redundant
+def compact_events():
+    refresh_and_sync()
+    #Events newer than the window stay, a concurrent Lambda may be compacting a data file that does not have them yet
+    watermark = event_key(time.time_ns() - event_window_seconds * 10**9)
+    if not upload_data_file():
+        #Another Lambda compacted in the meantime, the events stay for the next compaction
+        return
+    keys = []
+    for page in s3.get_paginator('list_objects_v2').paginate(Bucket=bucket, Prefix=events_prefix):
+        keys.extend(obj['Key'] for obj in page.get('Contents', []) if obj['Key'] < watermark)
+    for i in range(0, len(keys), 1000):
+        s3.delete_objects(Bucket=bucket, Delete={'Objects': [{'Key': key} for key in keys[i:i + 1000]], 'Quiet': True})
+    cursor.execute('DELETE FROM AppliedEvents WHERE EventKey < ?', (watermark,))
     conn.commit()
+    logger.info('Compacted ' + str(len(keys)) + ' order events into the data file')
+
+
+#Picks up orders placed by other Lambdas before placing one, read-only APIs serve the open database and never wait on S3
+def refresh_before_order():
+    global cursor
+    if persistence_mode == 'snapshot':
+        #Only a conditional GET when the data file has not changed
+        if refresh_data_file():
+            cursor = load_data()
+    elif time.monotonic() - last_sync > event_window_seconds:
+        #Idle longer than the window: events this copy never applied may have been compacted into the data file and deleted
+        refresh_and_sync()
+    elif time.monotonic() - last_sync > sync_interval_seconds:
+        sync_events(cursor)
+
+
+#Applies the items of one order in a single transaction and persists them with one S3 request
+def commit_order(custId, items, orderDate):
+    if persistence_mode == 'eventlog':
+        #The order is durable once its event is in S3, concurrent Lambdas each write their own event object
+        key = event_key(time.time_ns()) + '-' + uuid.uuid4().hex + '.json'
+        s3.put_object(Bucket=bucket, Key=key, Body=json.dumps({'CustomerID': custId, 'OrderDate': orderDate, 'Items': items}))
+        for item in items:
+            apply_order(cursor, item['ShoeID'], custId, orderDate, item['Quantity'])
+        cursor.execute('INSERT INTO AppliedEvents (EventKey) VALUES (?)', (key,))
+        conn.commit()
+        #Only events older than the window can be compacted, counting the newer ones would compact on every order under load
+        cursor.execute('SELECT count(*) FROM AppliedEvents WHERE EventKey < ?', (event_key(time.time_ns() - event_window_seconds * 10**9),))
+        if cursor.fetchone()[0] >= compact_after_events:
+            compact_events()
+        return
+
+    for attempt in range(3):
+        for item in items:
+            apply_order(cursor, item['ShoeID'], custId, orderDate, item['Quantity'])
+        conn.commit()
+        #Writing updated db file to S3, the connection stays open for the next invocation
+        if upload_data_file():
+            return
+        #Another Lambda uploaded its orders since the download, apply this order on top of them
+        refresh_before_order()
+    raise RuntimeError('Data file changed on every attempt, order not saved')
 
-    #Writing updated db file to S3 and setting cursor to None to force reload of data
-    s3.upload_file(local_db, bucket, db_name)
-    cursor = None
+
+#function places order -- reduces shoe inventory, updates order_details table --> all actions resulting from a shoe purchase  
+def place_shoe_order(ssId, custId):
+    refresh_before_order()
+    today = datetime.today().strftime('%Y-%m-%d')
+    commit_order(custId, [{'ShoeID': ssId, 'Quantity': 1}], today)
     logger.info('Shoe order placed')
     return 1;
-     
+
+
+#The agent passes the Items array as a string, either JSON or in the form [{ShoeID=1, Quantity=2}, {ShoeID=3}]
+def parse_line_items(value):
+    if isinstance(value, list):
+        return value
+    try:
+        return json.loads(value)
+    except ValueError:
+        return [dict(re.findall(r'(\w+)\s*=\s*([^,}]+)', item)) for item in re.findall(r'\{[^}]*\}', value)]
+
+
+#function places all line items of a cart in one transaction, items the inventory cannot cover are skipped and reported
+def place_shoe_orders(custId, items):
+    refresh_before_order()
+    today = datetime.today().strftime('%Y-%m-%d')
+    results = []
+    placed = []
+    available = {} #Inventory left per shoe after the items placed so far
+    for item in items:
+        try:
+            ssId = int(item['ShoeID'])
+            quantity = int(item.get('Quantity', 1))
+        except (KeyError, TypeError, ValueError):
+            results.append({'ShoeID': item.get('ShoeID') if isinstance(item, dict) else item, 'Status': 'Invalid'})
+            continue
+        if ssId not in available:
+            cursor.execute('SELECT InvCount FROM ShoeInventory WHERE ShoeID = ?', (ssId,))
+            row = cursor.fetchone()
+            available[ssId] = None if row is None else row[0]
+        if available[ssId] is None or quantity < 1:
+            results.append({'ShoeID': ssId, 'Quantity': quantity, 'Status': 'Invalid'})
+        elif available[ssId] < quantity:
+            results.append({'ShoeID': ssId, 'Quantity': quantity, 'Status': 'OutOfStock', 'Available': available[ssId]})
+        else:
+            available[ssId] = available[ssId] - quantity
+            placed.append({'ShoeID': ssId, 'Quantity': quantity})
+            results.append({'ShoeID': ssId, 'Quantity': quantity, 'Status': 'Placed'})
+    if placed:
+        commit_order(int(custId), placed, today)
+    logger.info('Shoe orders placed: ' + str(len(placed)) + ' of ' + str(len(results)) + ' items')
+    return results
+
 
 def lambda_handler(event, context):
     responses = []
@@ -95,6 +348,7 @@ def lambda_handler(event, context):
     if cursor == None:
         cursor = load_data()
     id = ''
+    status_code = 200
     api_path = event['apiPath']
     logger.info('API Path')
     logger.info(api_path)
@@ -113,6 +367,22 @@ def lambda_handler(event, context):
             if parameter["name"] == "CustomerID":
                 cid = parameter["value"]
         body = place_shoe_order(id, cid)
+    elif api_path == '/place_orders':
+        cid = None
+        items = None
+        properties = event.get('requestBody', {}).get('content', {}).get('application/json', {}).get('properties', [])
+        for prop in properties:
+            if prop["name"] == "CustomerID":
+                cid = prop["value"]
+            if prop["name"] == "Items":
+                items = prop["value"]
+        if items:
+            items = parse_line_items(items)
+        if not str(cid).strip().isdigit() or not isinstance(items, list) or not items:
+            status_code = 400
+            body = {'Error': 'A numeric CustomerID and a non-empty list of Items (ShoeID, Quantity) are required'}
+        else:
+            body = place_shoe_orders(cid, items)
     elif api_path == '/check_inventory':
         body = return_shoe_inventory()
     else:
@@ -128,7 +398,7 @@ def lambda_handler(event, context):
         'actionGroup': event['actionGroup'],
         'apiPath': event['apiPath'],
         'httpMethod': event['httpMethod'],
-        'httpStatusCode': 200,
+        'httpStatusCode': status_code,
         'responseBody': response_body
     }
 
@@ -0,0 +1,119 @@
+"""
+Orders per second of csbot_agent.place_shoe_order with each PERSISTENCE_MODE, against MinIO as a local S3 stand-in:
+
+    docker run -d -p 9000:9000 -e MINIO_ROOT_USER=minioadmin -e MINIO_ROOT_PASSWORD=minioadmin minio/minio server /data
+    python load_test_persistence.py --lambdas 4 --orders 100
+
+Every simulated Lambda is its own process with its own /tmp data file, placing orders one after the other like
+a warm Lambda serving /place_order. After the run a fresh cold start loads the data from S3 and counts the orders
+that survived: in snapshot mode concurrent Lambdas overwrite each other's data file, so orders are lost.
+The module level S3 client of csbot_agent finds MinIO through AWS_ENDPOINT_URL_S3 (boto3 1.28.57 or later).
+"""
+import os
+import time
+import sqlite3
+import argparse
+import multiprocessing
+import boto3
+
+DATA_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "data", "demo_csbot_db")
+DB_NAME = "demo_csbot_db"
+
+
+def lambda_env(args, mode, name):
+    os.environ.update({
+        "BUCKET_NAME": args.bucket,
+        "PERSISTENCE_MODE": mode,
+        "LOCAL_DB": os.path.join(args.tmp_dir, f"csbot-{mode}-{name}.db"),
+        "AWS_ENDPOINT_URL_S3": args.endpoint_url,
+        "AWS_ACCESS_KEY_ID": args.access_key,
+        "AWS_SECRET_ACCESS_KEY": args.secret_key,
+        "AWS_DEFAULT_REGION": "us-east-1",
+    })
+    if os.path.exists(os.environ["LOCAL_DB"]):
+        os.remove(os.environ["LOCAL_DB"])
+
+
+def place_orders(args, mode, worker, start, results):
+    lambda_env(args, mode, str(worker))
+    import csbot_agent  # cold start: downloads the data file
+    start.wait()
+    st = time.perf_counter()
+    for i in range(args.orders):
+        event = {
+            "apiPath": "/place_order", "actionGroup": "load-test", "httpMethod": "GET",
+            "parameters": [{"name": "ShoeID", "value": str(1 + i % 10)}, {"name": "CustomerID", "value": str(1 + worker % 10)}],
+        }
+        csbot_agent.lambda_handler(event, None)
+    results.put(time.perf_counter() - st)
+
+
+def count_orders(args, mode, results):
+    lambda_env(args, mode, "verify")
+    import csbot_agent
+    csbot_agent.cursor = csbot_agent.load_data()
+    csbot_agent.cursor.execute("SELECT count(*) FROM OrderDetails")
+    results.put(csbot_agent.cursor.fetchone()[0])
+
+
+def reset_bucket(s3, bucket):
+    try:
+        s3.create_bucket(Bucket=bucket)
+    except s3.exceptions.BucketAlreadyOwnedByYou:
+        pass
+    for page in s3.get_paginator("list_objects_v2").paginate(Bucket=bucket):
+        keys = [{"Key": obj["Key"]} for obj in page.get("Contents", [])]
+        if keys:
+            s3.delete_objects(Bucket=bucket, Delete={"Objects": keys, "Quiet": True})
+    s3.upload_file(DATA_FILE, bucket, DB_NAME)
+
+
+def run(args, mode):
+    ctx = multiprocessing.get_context("spawn")
+    start, results = ctx.Event(), ctx.Queue()
+    workers = [ctx.Process(target=place_orders, args=(args, mode, i, start, results)) for i in range(args.lambdas)]
+    for w in workers:
+        w.start()
+    time.sleep(args.warmup)  # let every process finish its cold start before the clock starts
+    st = time.perf_counter()
+    start.set()
+    for w in workers:
+        w.join()
+    elapsed = time.perf_counter() - st
+    [results.get() for _ in workers]
+
+    verify = ctx.Process(target=count_orders, args=(args, mode, results))
+    verify.start()
+    verify.join()
+    return elapsed, results.get()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--endpoint-url", default="http://localhost:9000")
+    parser.add_argument("--access-key", default="minioadmin")
+    parser.add_argument("--secret-key", default="minioadmin")
+    parser.add_argument("--bucket", default="csbot-load-test")
+    parser.add_argument("--lambdas", type=int, default=4, help="concurrent Lambda processes")
+    parser.add_argument("--orders", type=int, default=100, help="orders placed by each Lambda")
+    parser.add_argument("--warmup", type=float, default=5)
+    parser.add_argument("--modes", nargs="+", default=["snapshot", "eventlog"])
+    parser.add_argument("--tmp-dir", default="/tmp")
+    args = parser.parse_args()
+
+    s3 = boto3.client("s3", endpoint_url=args.endpoint_url, aws_access_key_id=args.access_key,
+                      aws_secret_access_key=args.secret_key, region_name="us-east-1")
+    conn = sqlite3.connect(DATA_FILE)
+    initial = conn.execute("SELECT count(*) FROM OrderDetails").fetchone()[0]
+    conn.close()
+    placed = args.lambdas * args.orders
+
+    print(f"{'mode':<10}{'orders':>8}{'seconds':>10}{'orders/s':>10}{'lost':>8}")
+    for mode in args.modes:
+        reset_bucket(s3, args.bucket)
+        elapsed, orders = run(args, mode)
+        print(f"{mode:<10}{placed:>8}{elapsed:>10.2f}{placed / elapsed:>10.1f}{initial + placed - orders:>8}")
+
+
+if __name__ == "__main__":
+    main()
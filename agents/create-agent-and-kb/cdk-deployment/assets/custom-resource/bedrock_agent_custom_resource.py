@@ -1,7 +1,7 @@
 import boto3
 import os
-import time
 import json
+import waiters
 
 agent_client = boto3.client("bedrock-agent")
 event_bridge_client = boto3.client("events")
@@ -52,8 +52,7 @@ def on_create(event, agent_name, s3_bucket,
   agent_id = create_agent(agent_resource_role_arn=bedrock_agent_role_arn, 
                           agent_name=agent_name, model_name=model_name,
                           instruction=instruction)
-  # Pause to make sure agents has been created                           
-  time.sleep(15)
+  waiters.wait_for_agent_status(agent_client, agent_id, ['NOT_PREPARED'])
 
   # Enable User Input
   print(
@@ -76,9 +75,7 @@ def on_create(event, agent_name, s3_bucket,
   print(
       f'Preparing agent with {agent_id} id ...')
   prepare_agent(agent_id=agent_id)
-
-  # Pause to make sure agent is in prepared state
-  time.sleep(7)
+  waiters.wait_for_agent_status(agent_client, agent_id, ['PREPARED'])
 
   print(
       f'Creating an alias for an agent with {agent_id} id ...')
@@ -98,9 +95,8 @@ def on_update(event, physical_id):
 def on_delete(event, agent_name, physical_id):
   # physical_id = event["PhysicalResourceId"]
   print("delete resource %s" % physical_id)
-  delete_agent_alias(agent_name=agent_name)
-  # Make sure alias is removed
-  time.sleep(7)
+  agent_id = delete_agent_alias(agent_name=agent_name)
+  waiters.wait_for_agent_aliases_deleted(agent_client, agent_id)
   delete_agent(agent_name=agent_name)
 
   return { 'PhysicalResourceId': physical_id } 
@@ -180,7 +176,7 @@ def delete_agent_alias(agent_name):
                                         agentAliasId=agent_alias_id)
         
 
-    return
+    return agent_id
             
 
 def delete_agent(agent_name):
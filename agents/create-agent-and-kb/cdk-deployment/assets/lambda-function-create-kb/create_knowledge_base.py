@@ -1,16 +1,23 @@
 from opensearchpy import OpenSearch, RequestsHttpConnection
+from opensearchpy.exceptions import AuthorizationException
 from requests_aws4auth import AWS4Auth
 import boto3
 import botocore
-import time
 import json
 import os
+import aws_clients
+import waiters
+from provisioning import Step, run_graph
 
-opensearch_serverless_client = boto3.client('opensearchserverless')
-agent_client = boto3.client("bedrock-agent")
-lambda_client = boto3.client('lambda')
-iam = boto3.client('iam')
-s3 = boto3.client('s3')
+# Independent provisioning steps run concurrently, see provisioning.py
+max_parallel_steps = int(os.environ.get('MAX_PARALLEL_STEPS', '8'))
+
+# the steps share these clients, a pooled connection per step running at the same time, see aws_clients.py
+opensearch_serverless_client = aws_clients.client('opensearchserverless', max_concurrency=max_parallel_steps)
+agent_client = aws_clients.client("bedrock-agent", max_concurrency=max_parallel_steps)
+lambda_client = aws_clients.client('lambda', max_concurrency=max_parallel_steps)
+iam = aws_clients.client('iam', max_concurrency=max_parallel_steps)
+s3 = aws_clients.client('s3', max_concurrency=max_parallel_steps)
 
 
 def get_agent_id_and_s3_bucket_name_from_payload(props):
@@ -170,32 +177,15 @@ def create_collection(agent_id):
             raise error
 
 
-def wait_for_collection_creation(awsauth,
-                                 agent_id,
-                                 vector_index_name, 
-                                 text_field, 
-                                 bedrock_metadata_field,
-                                 vector_field_name):
-    """Waits for the collection to become active"""
-    response = opensearch_serverless_client.batch_get_collection(
-        names=[f'collection-{agent_id}'])
-    # Periodically check collection status
-    while (response['collectionDetails'][0]['status']) == 'CREATING':
-        print('Creating collection...')
-        time.sleep(30)
-        response = opensearch_serverless_client.batch_get_collection(
-            names=[f'collection-{agent_id}'])
+def wait_for_collection_creation(agent_id):
+    """Waits for the collection to become active, returns its endpoint host"""
+    collection = waiters.wait_for_collection_active(opensearch_serverless_client,
+                                                    f'collection-{agent_id}')
     print('\nCollection successfully created:')
-    print(response["collectionDetails"])
+    print(collection)
     # Extract the collection endpoint from the response
-    host = (response['collectionDetails'][0]['collectionEndpoint'])
-    final_host = host.replace("https://", "")
-    index_data(host=final_host, 
-               awsauth=awsauth, 
-               vector_index_name=vector_index_name,
-               bedrock_metadata_field=bedrock_metadata_field,
-               text_field=text_field,
-               vector_field_name=vector_field_name)
+    host = (collection['collectionEndpoint'])
+    return host.replace("https://", "")
 
 
 def index_data(host, awsauth, vector_index_name, text_field, 
@@ -210,9 +200,6 @@ def index_data(host, awsauth, vector_index_name, text_field,
         connection_class=RequestsHttpConnection,
         timeout=300
     )
-    # It can take up to a minute for data access rules to be enforced
-    time.sleep(45)
-    
     # Create index
     body = {
       "mappings": {
@@ -256,9 +243,14 @@ def index_data(host, awsauth, vector_index_name, text_field,
       }
     }
 
-    response = client.indices.create(index=vector_index_name, body=body)
+    # It can take up to a minute for data access rules to be enforced, until then index creation is refused
+    response = waiters.call_with_retry(
+        lambda: client.indices.create(index=vector_index_name, body=body),
+        f'create index {vector_index_name}',
+        retryable=lambda error: isinstance(error, AuthorizationException))
     print('\nCreating index:')
     print(response)
+    waiters.wait_for_index(client, vector_index_name)
     
 
 def create_allow_bedrock_iam_policy(policy_name, agent_id):
@@ -437,12 +429,6 @@ def lambda_handler(event, context):
     response_code = 200
     props = event['detail']['requestBody']['content']['application/json']['properties']
     
-    # Get current role to attach to Opensearch allow list
-    role_response = (lambda_client.get_function_configuration(
-      FunctionName = os.environ['AWS_LAMBDA_FUNCTION_NAME'])
-    )
-    lambda_role_arn = role_response['Role']
-    
     # Get account id and current region
     account_id = context.invoked_function_arn.split(":")[4]
     region = os.environ['AWS_REGION']
@@ -469,56 +455,82 @@ def lambda_handler(event, context):
     
                    
     ##### Start of function calls
-    knowledge_base_role_arn = create_knowledge_base_iam_role(role_name=knowledge_base_role_name,
-                                                             account_id=account_id,
-                                                             region=region)
-    
-    # Pause to make sure iam role is created                           
-    time.sleep(10)
-    
-    create_encryption_policy(agent_id=agent_id_lowercase)
-    create_network_policy(agent_id=agent_id_lowercase)
-    # Attached is 'max-role' or 'Admin', make sure change it later
-    create_access_policy(account_id=account_id,
-                         agent_id=agent_id_lowercase,
-                         lambda_role_arn=lambda_role_arn, 
-                         knowledge_base_role_arn=knowledge_base_role_arn,
-                         account_iam_role=account_iam_role)
-    collection_arn = create_collection(agent_id=agent_id_lowercase)
-    wait_for_collection_creation(awsauth=awsauth, 
-                                 agent_id=agent_id_lowercase,
-                                 vector_index_name=vector_index_name,
-                                 text_field=text_field,
-                                 bedrock_metadata_field=bedrock_metadata_field,
-                                 vector_field_name=vector_field_name)
-    
-    bedrock_policy_arn = create_allow_bedrock_iam_policy(policy_name=bedrock_policy_name,
-                                                         agent_id=agent_id)
-    collection_policy_arn = create_allow_collection_access(policy_name=collection_policy_name, 
-                                                           collection_arn=collection_arn,
-                                                           agent_id=agent_id)
-                                                           
-    # Pause to make sure iam policies are created                           
-    time.sleep(10)                                                       
-                                                             
-    attach_bedrock_and_collection_policies(role_name=knowledge_base_role_name,
-                                           collection_policy_arn=collection_policy_arn,
-                                           bedrock_policy_arn=bedrock_policy_arn)
-                                           
-    # Pause to make sure iam policies are attached                           
-    time.sleep(10) 
-                                           
-    knowledge_base_id = create_knowledge_base(collection_arn=collection_arn, 
-                                              vector_field_name=vector_field_name,
-                                              vector_index_name=vector_index_name,
-                                              knowledge_base_role_arn=knowledge_base_role_arn,
-                                              text_field=text_field,
-                                              bedrock_metadata_field=bedrock_metadata_field,
-                                              agent_id=agent_id)
-    create_data_source(knowledge_base_id=knowledge_base_id,
-                       s3_bucket_name=s3_bucket_name,
-                       agent_id=agent_id)
-    associate_knowledge_base(agent_id=agent_id, knowledge_base_id=knowledge_base_id)
+    # Each step starts once the steps it depends on are done: the IAM role and policies are created
+    # while the collection is coming up, which takes minutes.
+    steps = [
+        # Get current role to attach to Opensearch allow list
+        Step('lambda_role_arn',
+             lambda: lambda_client.get_function_configuration(
+                 FunctionName=os.environ['AWS_LAMBDA_FUNCTION_NAME'])['Role']),
+        Step('knowledge_base_role_arn',
+             lambda: create_knowledge_base_iam_role(role_name=knowledge_base_role_name,
+                                                    account_id=account_id,
+                                                    region=region)),
+        Step('encryption_policy', lambda: create_encryption_policy(agent_id=agent_id_lowercase)),
+        Step('network_policy', lambda: create_network_policy(agent_id=agent_id_lowercase)),
+        # Attached is 'max-role' or 'Admin', make sure change it later
+        Step('access_policy',
+             lambda lambda_role_arn, knowledge_base_role_arn: create_access_policy(
+                 account_id=account_id,
+                 agent_id=agent_id_lowercase,
+                 lambda_role_arn=lambda_role_arn, 
+                 knowledge_base_role_arn=knowledge_base_role_arn,
+                 account_iam_role=account_iam_role),
+             depends_on=('lambda_role_arn', 'knowledge_base_role_arn')),
+        # A collection can only be created once an encryption policy matches its name
+        Step('collection_arn',
+             lambda encryption_policy, network_policy: create_collection(agent_id=agent_id_lowercase),
+             depends_on=('encryption_policy', 'network_policy')),
+        Step('collection_host',
+             lambda collection_arn: wait_for_collection_creation(agent_id=agent_id_lowercase),
+             depends_on=('collection_arn',)),
+        Step('index',
+             lambda collection_host, access_policy: index_data(host=collection_host, 
+                                                               awsauth=awsauth, 
+                                                               vector_index_name=vector_index_name,
+                                                               bedrock_metadata_field=bedrock_metadata_field,
+                                                               text_field=text_field,
+                                                               vector_field_name=vector_field_name),
+             depends_on=('collection_host', 'access_policy')),
+        Step('bedrock_policy_arn',
+             lambda: create_allow_bedrock_iam_policy(policy_name=bedrock_policy_name,
+                                                     agent_id=agent_id)),
+        Step('collection_policy_arn',
+             lambda collection_arn: create_allow_collection_access(policy_name=collection_policy_name, 
+                                                                   collection_arn=collection_arn,
+                                                                   agent_id=agent_id),
+             depends_on=('collection_arn',)),
+        Step('attached_policies',
+             lambda knowledge_base_role_arn, bedrock_policy_arn, collection_policy_arn: attach_bedrock_and_collection_policies(
+                 role_name=knowledge_base_role_name,
+                 collection_policy_arn=collection_policy_arn,
+                 bedrock_policy_arn=bedrock_policy_arn),
+             depends_on=('knowledge_base_role_arn', 'bedrock_policy_arn', 'collection_policy_arn')),
+        # Bedrock rejects the role until the new role and its policies have propagated through IAM
+        Step('knowledge_base_id',
+             lambda collection_arn, knowledge_base_role_arn, index, attached_policies: create_knowledge_base(
+                 collection_arn=collection_arn, 
+                 vector_field_name=vector_field_name,
+                 vector_index_name=vector_index_name,
+                 knowledge_base_role_arn=knowledge_base_role_arn,
+                 text_field=text_field,
+                 bedrock_metadata_field=bedrock_metadata_field,
+                 agent_id=agent_id),
+             depends_on=('collection_arn', 'knowledge_base_role_arn', 'index', 'attached_policies'),
+             retryable=lambda error: waiters.is_iam_propagation_error(error) or waiters.is_throttling_error(error)),
+        Step('data_source',
+             lambda knowledge_base_id: create_data_source(knowledge_base_id=knowledge_base_id,
+                                                          s3_bucket_name=s3_bucket_name,
+                                                          agent_id=agent_id),
+             depends_on=('knowledge_base_id',)),
+        Step('association',
+             lambda knowledge_base_id: associate_knowledge_base(agent_id=agent_id, knowledge_base_id=knowledge_base_id),
+             depends_on=('knowledge_base_id',)),
+    ]
+    results, report = run_graph(steps, max_workers=max_parallel_steps)
+    print(report)
+    knowledge_base_id = results['knowledge_base_id']
+    collection_policy_arn = results['collection_policy_arn']
    
     ##### End of function calls
     
@@ -0,0 +1,86 @@
+"""
+Runs provisioning steps as a dependency graph: a step starts as soon as the steps it depends on have finished, so
+independent steps (IAM role and policies, OpenSearch policies and collection) overlap instead of running in sequence.
+
+A step function receives the results of its dependencies as keyword arguments named after them, e.g.
+Step('index', index_fn, depends_on=('collection_host',)) calls index_fn(collection_host=...).
+"""
+import time
+import concurrent.futures
+
+import waiters
+
+
+class Step:
+    def __init__(self, name, fn, depends_on=(), retryable=waiters.is_throttling_error):
+        self.name = name
+        self.fn = fn
+        self.depends_on = tuple(depends_on)
+        self.retryable = retryable
+
+    def run(self, **dependencies):
+        st = time.monotonic()
+        # many calls at once are more likely to be throttled, retry with the same backoff as the waiters
+        result = waiters.call_with_retry(lambda: self.fn(**dependencies), self.name, retryable=self.retryable)
+        return result, time.monotonic() - st
+
+
+class GraphReport:
+    """Durations of the steps and the critical path: the chain of dependent steps that bounds the total time."""
+
+    def __init__(self, steps, durations, elapsed):
+        self.durations = durations
+        self.elapsed = elapsed
+        finish, previous = {}, {}
+        for step in steps:
+            previous[step.name] = max(step.depends_on, key=finish.get, default=None)
+            finish[step.name] = finish.get(previous[step.name], 0.0) + durations[step.name]
+        name = max(finish, key=finish.get)
+        self.critical_seconds = finish[name]
+        self.critical_path = []
+        while name:
+            self.critical_path.insert(0, name)
+            name = previous[name]
+
+    def __str__(self):
+        return (f'Provisioned in {self.elapsed:.1f}s, {sum(self.durations.values()):.1f}s of steps, '
+                f'critical path {self.critical_seconds:.1f}s: '
+                + ' -> '.join(f'{name} ({self.durations[name]:.1f}s)' for name in self.critical_path))
+
+
+def ordered(steps):
+    """Steps in dependency order, raises ValueError on a missing dependency or a cycle."""
+    by_name = {step.name: step for step in steps}
+    done, result = set(), []
+    while len(result) < len(steps):
+        ready = [step for step in steps if step.name not in done and all(dep in done for dep in step.depends_on)]
+        if not ready:
+            missing = {dep for step in steps for dep in step.depends_on if dep not in by_name}
+            raise ValueError(f'missing steps {missing}' if missing else
+                             f'cycle between {[step.name for step in steps if step.name not in done]}')
+        done.update(step.name for step in ready)
+        result.extend(ready)
+    return result
+
+
+def run_graph(steps, max_workers=8):
+    """Runs steps, returns (results by step name, GraphReport). The first failing step stops scheduling and raises."""
+    steps = ordered(steps)
+    st = time.monotonic()
+    results, durations, running = {}, {}, {}
+    pending = list(steps)
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max_workers) as pool:
+        while pending or running:
+            for step in [step for step in pending if all(dep in results for dep in step.depends_on)]:
+                pending.remove(step)
+                running[pool.submit(step.run, **{dep: results[dep] for dep in step.depends_on})] = step
+            done, _ = concurrent.futures.wait(running, return_when=concurrent.futures.FIRST_COMPLETED)
+            for future in done:
+                step = running.pop(future)
+                try:
+                    results[step.name], durations[step.name] = future.result()
+                except Exception:
+                    print(f'Step {step.name} failed, waiting for {[s.name for s in running.values()]} to finish')
+                    raise
+                print(f'Step {step.name} done in {durations[step.name]:.1f}s')
+    return results, GraphReport(steps, durations, time.monotonic() - st)
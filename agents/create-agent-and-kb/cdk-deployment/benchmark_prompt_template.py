@@ -0,0 +1,80 @@
+"""
+Rendering time of a 50KB prompt template with 20 placeholders, comparing the chain of str.replace calls that
+run_prompt_template and the email Lambdas used before (with and without reading the template file on every request,
+as the DynamoDB email Lambda did) with prompt_template.PromptTemplate, parsed once:
+
+    python benchmark_prompt_template.py --size 50000 --placeholders 20
+"""
+import os
+import sys
+import random
+import timeit
+import argparse
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "assets", "lambda-function-create-agent"))
+from prompt_template import PromptTemplate
+
+WORDS = ["agent", "schema", "lambda", "{", "}", "\"type\":", "payload", "Human:", "Assistant:", "\n", "<email>", "parcel"]
+
+
+def build_template(size, placeholders, rng):
+    """size characters of prompt-like text (braces included) with each placeholder once, evenly spread."""
+    names = [f"param_{i}" for i in range(placeholders)]
+    chunk = size // (placeholders + 1)
+    parts = []
+    for name in names + [None]:
+        text = []
+        while sum(map(len, text)) < chunk:
+            text.append(rng.choice(WORDS) + " ")
+        parts.append("".join(text))
+        if name:
+            parts.append("{" + name + "}")
+    return "".join(parts), names
+
+
+def replace_chain(template, parameter_dict):
+    prompt = template
+    for key in parameter_dict:
+        prompt = prompt.replace(key, parameter_dict[key])
+    return prompt
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--size", type=int, default=50_000, help="template size in characters")
+    parser.add_argument("--placeholders", type=int, default=20)
+    parser.add_argument("--value-size", type=int, default=500, help="characters per placeholder value")
+    parser.add_argument("--number", type=int, default=2000, help="renders per measurement")
+    args = parser.parse_args()
+
+    rng = random.Random(0)
+    template, names = build_template(args.size, args.placeholders, rng)
+    values = {name: "".join(rng.choice("abcdefghij ") for _ in range(args.value_size)) for name in names}
+    braced = {"{" + name + "}": value for name, value in values.items()}
+    with tempfile.NamedTemporaryFile("w", suffix=".txt", delete=False) as f:
+        f.write(template)
+
+    compiled = PromptTemplate(template, names)
+    assert compiled.render(values) == replace_chain(template, braced)
+
+    def replace_from_file():
+        with open(f.name) as fp:
+            return replace_chain(fp.read(), braced)
+
+    cases = {
+        "read file + replace chain": replace_from_file,
+        "replace chain": lambda: replace_chain(template, braced),
+        "PromptTemplate.render": lambda: compiled.render(values),
+        "PromptTemplate parse": lambda: PromptTemplate(template, names),
+    }
+    print(f"template {len(template)} chars, {len(names)} placeholders, values {args.value_size} chars")
+    print(f"{'method':<28}{'us per call':>14}")
+    for name, fn in cases.items():
+        seconds = min(timeit.repeat(fn, number=args.number, repeat=5)) / args.number
+        print(f"{name:<28}{seconds * 1e6:>14.1f}")
+    os.remove(f.name)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,392 @@
+"""
+End-to-end provisioning time of the agent custom resource (create and delete) and of the create knowledge base
+Lambda against a mocked control plane, comparing the status-polling waiters with the fixed sleeps they replaced:
+
+    python benchmark_provisioning.py
+
+Nothing is deployed and nothing waits for real: boto3, opensearchpy and requests_aws4auth are replaced by fakes
+whose resources become ready after simulated latencies, and time.sleep/time.monotonic run on a virtual clock
+--speedup times faster than real time, so concurrent steps overlap as they would in a deployment.
+Each profile is a set of latencies, in seconds, for the steps the old code covered with a sleep. The fixed-sleep
+baseline is the sum of those sleeps (the collection poll rounds up to 30s) and is marked as broken when a latency
+is longer than the sleep that was supposed to cover it.
+
+The create knowledge base Lambda runs twice: with MAX_PARALLEL_STEPS=1 ("kb in sequence", the order of the
+previous version) and as a concurrent dependency graph ("kb graph"). "kb critical path" is the longest chain of
+dependent steps in the graph run, as reported by provisioning.GraphReport.
+"""
+import os
+import sys
+import math
+import time
+import types
+import random
+import argparse
+import importlib
+
+from botocore.exceptions import ClientError
+
+ASSETS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "assets")
+
+PROFILES = {
+    # everything ready on the first check
+    "instant": dict(agent_create=0, agent_prepare=0, alias_delete=0, iam_propagation=0, collection=30, data_access=0),
+    "typical": dict(agent_create=2, agent_prepare=4, alias_delete=1, iam_propagation=8, collection=150, data_access=20),
+    # slower than the old sleeps assumed: the fixed-sleep version fails here
+    "slow": dict(agent_create=25, agent_prepare=12, alias_delete=9, iam_propagation=35, collection=420, data_access=70),
+}
+
+# The sleeps of the previous version, see git history of the files under assets/
+FIXED_SLEEPS = {
+    "custom resource create": dict(agent_create=15, agent_prepare=7),
+    "custom resource delete": dict(alias_delete=7),
+    "create knowledge base": dict(iam_propagation=30, data_access=45),
+}
+for step in ("kb in sequence", "kb graph", "kb critical path"):
+    FIXED_SLEEPS[step] = FIXED_SLEEPS["create knowledge base"]
+del FIXED_SLEEPS["create knowledge base"]
+COLLECTION_POLL = 30
+API_CALL_SECONDS = 0.05
+
+
+REAL_SLEEP, REAL_MONOTONIC = time.sleep, time.monotonic
+
+
+class Clock:
+    def __init__(self, speedup):
+        self.speedup = speedup
+        self.start = REAL_MONOTONIC()
+
+    @property
+    def now(self):
+        return self.monotonic()
+
+    def monotonic(self):
+        return (REAL_MONOTONIC() - self.start) * self.speedup
+
+    def sleep(self, seconds):
+        REAL_SLEEP(seconds / self.speedup)
+
+
+class ControlPlane:
+    """Resources of the mocked services, each one ready at a point in virtual time."""
+
+    def __init__(self, clock, latencies):
+        self.clock = clock
+        self.latencies = latencies
+        self.calls = 0
+        self.agents = {}
+        self.aliases = {}
+        self.collections = {}
+        self.roles_ready_at = 0.0
+        self.index_created = False
+
+    def call(self):
+        self.calls += 1
+        self.clock.sleep(API_CALL_SECONDS)
+
+    def after(self, name):
+        return self.clock.now + self.latencies[name]
+
+
+class AgentClient:
+    def __init__(self, plane):
+        self.plane = plane
+
+    def create_agent(self, agentName, agentResourceRoleArn, **kwargs):
+        self.plane.call()
+        agent_id = f"AGENT{len(self.plane.agents):05d}"
+        self.plane.agents[agent_id] = dict(name=agentName, status="CREATING", ready_at=self.plane.after("agent_create"),
+                                           next_status="NOT_PREPARED")
+        return {"agent": {"agentId": agent_id, "agentStatus": "CREATING"}}
+
+    def get_agent(self, agentId):
+        self.plane.call()
+        agent = self.plane.agents[agentId]
+        if self.plane.clock.now >= agent["ready_at"]:
+            agent["status"] = agent["next_status"]
+        return {"agent": {"agentId": agentId, "agentStatus": agent["status"]}}
+
+    def prepare_agent(self, agentId):
+        agent = self.agents_ready(agentId)
+        agent.update(status="PREPARING", ready_at=self.plane.after("agent_prepare"), next_status="PREPARED")
+        return {"agentId": agentId, "agentStatus": "PREPARING"}
+
+    def agents_ready(self, agent_id):
+        self.plane.call()
+        agent = self.plane.agents[agent_id]
+        if self.plane.clock.now < agent["ready_at"]:
+            raise ClientError({"Error": {"Code": "ConflictException", "Message": f"agent {agent_id} is {agent['status']}"}},
+                              "AgentOperation")
+        return agent
+
+    def list_agent_action_groups(self, agentId, agentVersion):
+        self.plane.call()
+        return {"actionGroupSummaries": [{"actionGroupName": "UserInputAction", "actionGroupId": "UI"}]}
+
+    def update_agent_action_group(self, agentId, **kwargs):
+        self.agents_ready(agentId)
+
+    def create_agent_action_group(self, agentId, **kwargs):
+        self.agents_ready(agentId)
+
+    def create_agent_alias(self, agentId, agentAliasName):
+        agent = self.agents_ready(agentId)
+        if agent["status"] != "PREPARED":
+            raise ClientError({"Error": {"Code": "ValidationException", "Message": "agent is not prepared"}}, "CreateAgentAlias")
+        alias_id = f"ALIAS{len(self.plane.aliases):05d}"
+        self.plane.aliases[alias_id] = dict(agent_id=agentId, deleted_at=None)
+        return {"agentAlias": {"agentAliasId": alias_id}}
+
+    def list_agents(self):
+        self.plane.call()
+        return {"agentSummaries": [{"agentId": agent_id, "agentName": agent["name"]} for agent_id, agent in self.plane.agents.items()]}
+
+    def list_agent_aliases(self, agentId):
+        self.plane.call()
+        now = self.plane.clock.now
+        return {"agentAliasSummaries": [{"agentAliasId": alias_id, "agentAliasName": alias_id}
+                                        for alias_id, alias in self.plane.aliases.items()
+                                        if alias["agent_id"] == agentId and (alias["deleted_at"] is None or now < alias["deleted_at"])]}
+
+    def delete_agent_alias(self, agentId, agentAliasId):
+        self.plane.call()
+        self.plane.aliases[agentAliasId]["deleted_at"] = self.plane.after("alias_delete")
+        return {"agentId": agentId, "agentAliasId": agentAliasId, "agentAliasStatus": "DELETING"}
+
+    def delete_agent(self, agentId):
+        self.plane.call()
+        if self.list_agent_aliases(agentId)["agentAliasSummaries"]:
+            raise ClientError({"Error": {"Code": "ConflictException", "Message": "agent still has aliases"}}, "DeleteAgent")
+        del self.plane.agents[agentId]
+        return {"agentId": agentId, "agentStatus": "DELETING"}
+
+    def create_knowledge_base(self, name, roleArn, **kwargs):
+        self.plane.call()
+        if self.plane.clock.now < self.plane.roles_ready_at:
+            raise ClientError({"Error": {"Code": "ValidationException",
+                                         "Message": f"Bedrock is not authorized to assume role {roleArn}"}}, "CreateKnowledgeBase")
+        return {"knowledgeBase": {"knowledgeBaseId": "KB00001"}}
+
+    def create_data_source(self, **kwargs):
+        self.plane.call()
+
+    def associate_agent_knowledge_base(self, **kwargs):
+        self.plane.call()
+
+
+class IamClient:
+    def __init__(self, plane):
+        self.plane = plane
+
+    def touch(self):
+        # every change to the role or its policies starts another propagation delay
+        self.plane.call()
+        self.plane.roles_ready_at = self.plane.after("iam_propagation")
+
+    def create_role(self, RoleName, **kwargs):
+        self.touch()
+
+    def attach_role_policy(self, RoleName, PolicyArn):
+        self.touch()
+
+    def create_policy(self, PolicyName, **kwargs):
+        self.touch()
+        return {"Policy": {"Arn": f"arn:aws:iam::123456789012:policy/{PolicyName}"}}
+
+    def get_role(self, RoleName):
+        self.plane.call()
+        return {"Role": {"Arn": f"arn:aws:iam::123456789012:role/{RoleName}"}}
+
+
+class OpenSearchServerlessClient:
+    def __init__(self, plane):
+        self.plane = plane
+
+    def create_security_policy(self, **kwargs):
+        self.plane.call()
+
+    def create_access_policy(self, **kwargs):
+        self.plane.call()
+
+    def create_collection(self, name, **kwargs):
+        self.plane.call()
+        self.plane.collections[name] = self.plane.after("collection")
+        return {"createCollectionDetail": {"arn": f"arn:aws:aoss:us-east-1:123456789012:collection/{name}"}}
+
+    def batch_get_collection(self, names):
+        self.plane.call()
+        ready_at = self.plane.collections[names[0]]
+        status = "ACTIVE" if self.plane.clock.now >= ready_at else "CREATING"
+        return {"collectionDetails": [{"name": names[0], "status": status, "collectionEndpoint": f"https://{names[0]}.aoss.amazonaws.com"}]}
+
+
+class LambdaClient:
+    def __init__(self, plane):
+        self.plane = plane
+
+    def get_function_configuration(self, FunctionName):
+        self.plane.call()
+        return {"Role": "arn:aws:iam::123456789012:role/create-kb-lambda"}
+
+
+def fake_modules(plane):
+    """boto3, opensearchpy and requests_aws4auth modules talking to the mocked control plane."""
+    clients = {
+        "bedrock-agent": AgentClient(plane),
+        "iam": IamClient(plane),
+        "opensearchserverless": OpenSearchServerlessClient(plane),
+        "lambda": LambdaClient(plane),
+    }
+    boto3 = types.ModuleType("boto3")
+    boto3.client = lambda service, **kwargs: clients.get(service, types.SimpleNamespace())
+    boto3.Session = lambda: types.SimpleNamespace(
+        get_credentials=lambda: types.SimpleNamespace(access_key="AKIA", secret_key="secret", token="token"),
+        client=boto3.client)
+    # aws_clients.py creates its clients from a session of its own
+    boto3.session = types.SimpleNamespace(Session=boto3.Session)
+
+    class AuthorizationException(Exception):
+        pass
+
+    class Indices:
+        def create(self, index, body):
+            plane.call()
+            if plane.clock.now < plane.data_access_ready_at:
+                raise AuthorizationException(403, "security_exception", "no permissions for [indices:admin/create]")
+            plane.index_created = True
+            return {"acknowledged": True, "index": index}
+
+        def exists(self, index):
+            plane.call()
+            return plane.index_created
+
+    opensearchpy = types.ModuleType("opensearchpy")
+    opensearchpy.OpenSearch = lambda **kwargs: types.SimpleNamespace(indices=Indices())
+    opensearchpy.RequestsHttpConnection = object
+    exceptions = types.ModuleType("opensearchpy.exceptions")
+    exceptions.AuthorizationException = AuthorizationException
+    opensearchpy.exceptions = exceptions
+    aws4auth = types.ModuleType("requests_aws4auth")
+    aws4auth.AWS4Auth = lambda *args, **kwargs: None
+    return {"boto3": boto3, "opensearchpy": opensearchpy, "opensearchpy.exceptions": exceptions, "requests_aws4auth": aws4auth}
+
+
+def load(asset_dir, module_name, modules):
+    """Imports a Lambda module of asset_dir, with its own copies of waiters.py and aws_clients.py, against the fake modules."""
+    for name in (module_name, "waiters", "aws_clients"):
+        sys.modules.pop(name, None)
+    sys.modules.update(modules)
+    sys.path.insert(0, os.path.join(ASSETS, asset_dir))
+    try:
+        return importlib.import_module(module_name)
+    finally:
+        sys.path.pop(0)
+
+
+def run_custom_resource(plane, modules):
+    os.environ.update(AGENT_NAME="bench-agent", S3_BUCKET="bucket", S3_BUCKET_CREATE_AGENT_KEY="agent.json",
+                      S3_BUCKET_CREATE_KB_KEY="kb.json", BEDROCK_AGENT_ROLE_ARN="arn:aws:iam::123456789012:role/agent",
+                      BEDROCK_CREATE_AGENT_LAMBDA_ARN="arn:aws:lambda:us-east-1:123456789012:function:create-agent",
+                      BEDROCK_INVOKE_CREATE_KB_LAMBDA_ARN="arn:aws:lambda:us-east-1:123456789012:function:create-kb",
+                      INSTRUCTION="instruction", MODEL_NAME="anthropic.claude-v2", RESOURCE_ID="resource")
+    module = load("custom-resource", "bedrock_agent_custom_resource", modules)
+    st = plane.clock.now
+    module.on_event({"RequestType": "Create", "ResourceProperties": {}}, None)
+    created = plane.clock.now - st
+    st = plane.clock.now
+    module.on_event({"RequestType": "Delete"}, None)
+    return {"custom resource create": created, "custom resource delete": plane.clock.now - st}
+
+
+def run_create_knowledge_base(plane, modules, max_parallel_steps):
+    os.environ.update(AWS_LAMBDA_FUNCTION_NAME="create-kb", AWS_REGION="us-east-1", MAX_PARALLEL_STEPS=str(max_parallel_steps))
+    module = load("lambda-function-create-kb", "create_knowledge_base", modules)
+    reports = []
+    run_graph = module.run_graph
+
+    def run_and_report(steps, max_workers):
+        results, report = run_graph(steps, max_workers)
+        reports.append(report)
+        return results, report
+
+    module.run_graph = run_and_report
+    collection_active = OpenSearchServerlessClient.batch_get_collection
+
+    def batch_get_collection(client, names):
+        # data access rules are enforced some time after the collection is active
+        response = collection_active(client, names)
+        if response["collectionDetails"][0]["status"] == "ACTIVE" and plane.data_access_ready_at == math.inf:
+            plane.data_access_ready_at = plane.after("data_access")
+        return response
+
+    OpenSearchServerlessClient.batch_get_collection = batch_get_collection
+    try:
+        event = {"detail": {"requestBody": {"content": {"application/json": {"properties": [
+            {"name": "agentId", "value": "AGENT00000"}, {"name": "s3KnowledgeBaseBucketName", "value": "kb-bucket"}]}}}}}
+        context = types.SimpleNamespace(invoked_function_arn="arn:aws:lambda:us-east-1:123456789012:function:create-kb")
+        st = plane.clock.now
+        module.lambda_handler(event, context)
+        if max_parallel_steps == 1:
+            return {"kb in sequence": plane.clock.now - st}
+        return {"kb graph": plane.clock.now - st, "kb critical path": reports[0].critical_seconds}
+    finally:
+        OpenSearchServerlessClient.batch_get_collection = collection_active
+
+
+def fixed_sleep_baseline(step, latencies):
+    """Seconds the step spent sleeping before, and whether the sleeps were long enough for these latencies."""
+    sleeps = FIXED_SLEEPS[step]
+    seconds = sum(sleeps.values())
+    if step.startswith("kb "):
+        seconds += max(1, math.ceil(latencies["collection"] / COLLECTION_POLL)) * COLLECTION_POLL
+    return seconds, all(latencies[name] <= sleep for name, sleep in sleeps.items())
+
+
+def new_plane(clock, profile):
+    plane = ControlPlane(clock, PROFILES[profile])
+    plane.data_access_ready_at = math.inf
+    return plane, fake_modules(plane)
+
+
+def run_profile(clock, profile):
+    plane, modules = new_plane(clock, profile)
+    timings = {**run_custom_resource(plane, modules), **run_create_knowledge_base(plane, modules, 1)}
+    plane, modules = new_plane(clock, profile)
+    return {**timings, **run_create_knowledge_base(plane, modules, 8)}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--profiles", nargs="+", default=list(PROFILES), choices=list(PROFILES))
+    parser.add_argument("--runs", type=int, default=5, help="runs per profile, the backoff jitter varies between them")
+    parser.add_argument("--speedup", type=float, default=200, help="virtual seconds per real second")
+    parser.add_argument("--verbose", action="store_true", help="keep the prints of the Lambda functions")
+    args = parser.parse_args()
+
+    clock = Clock(args.speedup)
+    time.sleep, time.monotonic = clock.sleep, clock.monotonic
+    stdout = sys.stdout
+    print(f"{'profile':<10}{'step':<26}{'fixed sleeps s':>16}{'waiters mean s':>16}{'max s':>8}")
+    for profile in args.profiles:
+        results = {}
+        for run in range(args.runs):
+            random.seed(run)
+            if not args.verbose:
+                sys.stdout = open(os.devnull, "w")
+            try:
+                timings = run_profile(clock, profile)
+            finally:
+                if sys.stdout is not stdout:
+                    sys.stdout.close()
+                    sys.stdout = stdout
+            for step, seconds in timings.items():
+                results.setdefault(step, []).append(seconds)
+        for step, seconds in results.items():
+            baseline, enough = fixed_sleep_baseline(step, PROFILES[profile])
+            fixed = f"{baseline:.1f}" if enough else f"{baseline:.1f} (fails)"
+            print(f"{profile:<10}{step:<26}{fixed:>16}{sum(seconds) / len(seconds):>16.1f}{max(seconds):>8.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,7 @@
 import boto3
 import os
-import time
 import json
+import waiters
 
 agent_client = boto3.client("bedrock-agent")
 
@@ -41,8 +41,7 @@ def on_create(event, agent_name, s3_bucket, bedrock_agent_role_arn,
   agent_id = create_agent(agent_resource_role_arn=bedrock_agent_role_arn, 
                           agent_name=agent_name, model_name=model_name,
                           instruction=instruction)
-  # Pause to make sure agents has been created                           
-  time.sleep(15)
+  waiters.wait_for_agent_status(agent_client, agent_id, ['NOT_PREPARED'])
   create_agent_action_group(bucket=s3_bucket, agent_id=agent_id,
                             lambda_arn=bedrock_agent_lambda_arn,
                             key=s3_bucket_key)
@@ -50,9 +49,7 @@ def on_create(event, agent_name, s3_bucket, bedrock_agent_role_arn,
   print(
       f'Preparing agent with {agent_id} id ...')
   prepare_agent(agent_id=agent_id)
-
-  # Pause to make sure agent is in prepared state
-  time.sleep(7)
+  waiters.wait_for_agent_status(agent_client, agent_id, ['PREPARED'])
 
   print(
       f'Creating an alias for an agent with {agent_id} id ...')
@@ -72,9 +69,8 @@ def on_update(event, physical_id):
 def on_delete(event, agent_name, physical_id):
   # physical_id = event["PhysicalResourceId"]
   print("delete resource %s" % physical_id)
-  delete_agent_alias(agent_name=agent_name, alias_name=f'{agent_name}-alias')
-  # Make sure alias is removed
-  time.sleep(7)
+  deleted = delete_agent_alias(agent_name=agent_name, alias_name=f'{agent_name}-alias')
+  waiters.wait_for_agent_aliases_deleted(agent_client, deleted['agentId'], [deleted['agentAliasId']])
   delete_agent(agent_name=agent_name)
 
   return { 'PhysicalResourceId': physical_id } 
@@ -1,17 +1,22 @@
-import boto3
 import shutil
 import os
-import time
 import json
+import time
 import random
+import concurrent.futures
+import aws_clients
+import waiters
+from prompt_template import PromptTemplate
 
+# steps of the agent creation running at the same time, see create_agent_resources
+MAX_PARALLEL_STAGES = 4
 
-s3 = boto3.resource('s3')
-s3_client = boto3.client('s3')
-iam = boto3.client('iam')
-lambda_client = boto3.client('lambda')
-agent_client = boto3.client("bedrock-agent")
-bedrock_runtime = boto3.client('bedrock-runtime')
+s3 = aws_clients.resource('s3')
+s3_client = aws_clients.client('s3', max_concurrency=MAX_PARALLEL_STAGES)
+iam = aws_clients.client('iam', max_concurrency=MAX_PARALLEL_STAGES)
+lambda_client = aws_clients.client('lambda')
+agent_client = aws_clients.client("bedrock-agent")
+bedrock_runtime = aws_clients.client('bedrock-runtime', max_concurrency=MAX_PARALLEL_STAGES, retry_mode='adaptive')
 
 
 LAMBDA_ROLE = os.environ.get('LAMBDA_ROLE_ARN') or "create_default_lambda_role_for_me"
@@ -22,14 +27,14 @@ BASE_S3_KEY = os.environ.get('BASE_S3_KEY') or "create-agent"
 REGION = os.environ.get('AWS_REGION')
 
 
-with open('gen_lambda.template') as f:
-    GEN_LAMBDA_PROMPT_TEMPLATE = f.read()
+GEN_LAMBDA_PROMPT_TEMPLATE = PromptTemplate.from_file('gen_lambda.template',
+                                                      ['api_schema_json_text', 'example_lambda'])
 
-with open('gen_test_payloads.template') as f:
-    GEN_TEST_PAYLOADS_PROMPT_TEMPLATE = f.read()
+GEN_TEST_PAYLOADS_PROMPT_TEMPLATE = PromptTemplate.from_file('gen_test_payloads.template',
+                                                             ['api_schema_json_text', 'example_payload'])
 
-with open('gen_api_schema.template') as f:
-    GEN_API_SCHEMA_PROMPT_TEMPLATE = f.read()
+GEN_API_SCHEMA_PROMPT_TEMPLATE = PromptTemplate.from_file('gen_api_schema.template',
+                                                          ['agent_name', 'api_description'])
 
 with open('example_lambda.py') as f:
     EXAMPLE_LAMBDA = f.read()
@@ -49,15 +54,36 @@ def get_named_property(event, name):
     return next(item for item in event['requestBody']['content']['application/json']['properties'] if item['name'] == name)['value']
 
 
+class StageTimings:
+    """Seconds spent in each stage of a request, stages running in parallel threads included."""
+
+    def __init__(self):
+        self.start = time.perf_counter()
+        self.seconds = {}
+
+    def timed(self, stage, fn, *args, **kwargs):
+        st = time.perf_counter()
+        try:
+            return fn(*args, **kwargs)
+        finally:
+            self.seconds[stage] = round(time.perf_counter() - st, 2)
+
+    def first_token(self, stage):
+        """Callback for run_prompt_template recording the time to the first generated token."""
+        st = time.perf_counter()
+        return lambda: self.seconds.setdefault(f'{stage} first token', round(time.perf_counter() - st, 2))
+
+    def __str__(self):
+        return json.dumps({**self.seconds, 'total': round(time.perf_counter() - self.start, 2)})
+
+
 def run_prompt_template(prompt_template, parameter_dict,
                         model_id=MODEL_ID,
-                        max_tokens_to_sample=3000, temperature=1.0, top_p=0.9):
-    prompt = prompt_template
+                        max_tokens_to_sample=3000, temperature=1.0, top_p=0.9,
+                        on_first_token=None):
+    prompt = prompt_template.render(parameter_dict)
     model_id = model_id or "anthropic.claude-v2"
 
-    for key in parameter_dict:
-        prompt = prompt.replace(key, parameter_dict[key])
-
     body = json.dumps({
         "prompt": prompt,
         "max_tokens_to_sample": max_tokens_to_sample,
@@ -65,33 +91,42 @@ def run_prompt_template(prompt_template, parameter_dict,
         "top_p": top_p,
     })
 
-    response = bedrock_runtime.invoke_model(
+    # Streamed so the time to the first token can be reported separately from the generation time
+    response = bedrock_runtime.invoke_model_with_response_stream(
         body=body,
         modelId=model_id,
         accept='application/json',
         contentType='application/json'
     )
 
-    response_body = json.loads(response.get('body').read())
-    return response_body.get('completion')
+    completion = []
+    for event in response.get('body'):
+        chunk = json.loads(event['chunk']['bytes'])
+        if not completion and on_first_token:
+            on_first_token()
+        completion.append(chunk.get('completion', ''))
+    return ''.join(completion)
 
 
-def create_api_schema(agent_name, api_description):
+def create_api_schema(agent_name, api_description, on_first_token=None):
     return run_prompt_template(GEN_API_SCHEMA_PROMPT_TEMPLATE,
-                               {"{agent_name}": agent_name,
-                                "{api_description}": api_description})
+                               {"agent_name": agent_name,
+                                "api_description": api_description},
+                               on_first_token=on_first_token)
 
 
-def create_lambda_function_code(agent_name, api_schema_json_text):
+def create_lambda_function_code(agent_name, api_schema_json_text, on_first_token=None):
     return run_prompt_template(GEN_LAMBDA_PROMPT_TEMPLATE,
-                               {"{api_schema_json_text}": api_schema_json_text,
-                                "{example_lambda}": EXAMPLE_LAMBDA})
+                               {"api_schema_json_text": api_schema_json_text,
+                                "example_lambda": EXAMPLE_LAMBDA},
+                               on_first_token=on_first_token)
 
 
-def create_test_payloads(api_schema_json_text):
+def create_test_payloads(api_schema_json_text, on_first_token=None):
     return run_prompt_template(GEN_TEST_PAYLOADS_PROMPT_TEMPLATE,
-                               {"{api_schema_json_text}": api_schema_json_text,
-                                "{example_payload}": EXAMPLE_TEST_PAYLOAD})
+                               {"api_schema_json_text": api_schema_json_text,
+                                "example_payload": EXAMPLE_TEST_PAYLOAD},
+                               on_first_token=on_first_token)
 
 
 def create_lambda_iam_role(role_name):
@@ -232,6 +267,13 @@ def save_file_to_s3(s3_bucket, object_key, text):
     return s3_client.put_object(Bucket=s3_bucket, Key=object_key, Body=text)
 
 
+def draft_artifact(timings, stage, generate, args, s3_bucket, key):
+    """Generates one artifact with the model and saves it to S3 as soon as it is complete."""
+    text = timings.timed(stage, generate, *args, on_first_token=timings.first_token(stage))
+    timings.timed(f'{stage} upload', save_file_to_s3, s3_bucket, key, text)
+    return text
+
+
 def create_lambda_function(function_name, lambda_function_code, role):
 
     try:
@@ -306,46 +348,85 @@ def draft_and_create_agent(event, context):
 
     schema_filename = f'{agent_name}-schema.json'
     schema_key = f'{base_key}/{schema_filename}'
-    print(
-        f'Drafting {agent_name} OpenAPI Schema to {s3_bucket}/{schema_key}, based on:\n{api_description}...')
-    api_schema_json_text = create_api_schema(agent_name, api_description)
-    save_file_to_s3(s3_bucket, schema_key, api_schema_json_text)
-
     lambda_key = f'{base_key}/{agent_name}-lambda.py'
-    print(f'Drafting {agent_name} Lambda function to {s3_bucket}/{lambda_key}...')
-    lambda_function_code = create_lambda_function_code(
-        agent_name, api_schema_json_text)
-    save_file_to_s3(s3_bucket, lambda_key, lambda_function_code)
-
     test_payloads_filename = f'{agent_name}-test-payloads.json'
     payload_key = f'{base_key}/{test_payloads_filename}'
-    print(f'Drafting {agent_name} test payloads to {s3_bucket}/{payload_key}...')
-    test_payloads_text = create_test_payloads(api_schema_json_text)
-    save_file_to_s3(s3_bucket, payload_key, test_payloads_text)
+    timings = StageTimings()
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=MAX_PARALLEL_STAGES) as pool:
+        # The IAM roles do not depend on the generated artifacts, create them while the model writes
+        if LAMBDA_ROLE == "create_default_lambda_role_for_me":
+            print(
+            f"""Lambda ARN was not provided. 
+               Creating a default Lambda IAM role called {lambda_role_name}"""
+            )
+            lambda_role = pool.submit(timings.timed, 'lambda role', create_lambda_iam_role, lambda_role_name)
+        else:
+            lambda_role = None
 
-    
-    if LAMBDA_ROLE == "create_default_lambda_role_for_me":
         print(
-        f"""Lambda ARN was not provided. 
-           Creating a default Lambda IAM role called {lambda_role_name}"""
-        )
-        lambda_role_arn = create_lambda_iam_role(lambda_role_name)
-    else:
-        lambda_role_arn = LAMBDA_ROLE
+            f"""Creating a Lambda IAM role called {lambda_role_name} 
+              and an agent IAM role called {agent_role_name}..."""
+            )
+        agent_role = pool.submit(timings.timed, 'agent role', create_agent_iam_role, role_name=agent_role_name)
 
-    print(
-        f"""Creating a Lambda IAM role called {lambda_role_name} 
-          and an agent IAM role called {agent_role_name}..."""
-        )
-    agent_role_arn = create_agent_iam_role(role_name=agent_role_name)
+        print(
+            f'Drafting {agent_name} OpenAPI Schema to {s3_bucket}/{schema_key}, based on:\n{api_description}...')
+        api_schema_json_text = draft_artifact(timings, 'api schema', create_api_schema,
+                                              (agent_name, api_description), s3_bucket, schema_key)
+
+        # The Lambda code and the test payloads only depend on the schema, draft them concurrently
+        print(f'Drafting {agent_name} Lambda function to {s3_bucket}/{lambda_key}...')
+        lambda_code = pool.submit(draft_artifact, timings, 'lambda code', create_lambda_function_code,
+                                  (agent_name, api_schema_json_text), s3_bucket, lambda_key)
+        print(f'Drafting {agent_name} test payloads to {s3_bucket}/{payload_key}...')
+        test_payloads = pool.submit(draft_artifact, timings, 'test payloads', create_test_payloads,
+                                    (api_schema_json_text,), s3_bucket, payload_key)
+
+        lambda_function_code = lambda_code.result()
+        lambda_role_arn = lambda_role.result() if lambda_role else LAMBDA_ROLE
+        agent_role_arn = agent_role.result()
+
+        # Nothing below needs the test payloads, they are only waited for at the end
+        agent_id, alias_id = create_agent_resources(
+            timings, agent_name=agent_name, s3_bucket=s3_bucket, schema_key=schema_key,
+            agent_instruction=agent_instruction, account_id=account_id, agent_alias_name=agent_alias_name,
+            lambda_function_name=lambda_function_name, lambda_function_code=lambda_function_code,
+            lambda_role_arn=lambda_role_arn, agent_role_name=agent_role_name, agent_role_arn=agent_role_arn,
+            bedrock_agent_bedrock_allow_policy_name=bedrock_agent_bedrock_allow_policy_name,
+            bedrock_agent_s3_allow_policy_name=bedrock_agent_s3_allow_policy_name,
+            bedrock_agent_lambda_allow_policy_name=bedrock_agent_lambda_allow_policy_name)
+        test_payloads.result()
+
+    print(f'Stage latencies (s): {timings}')
+
+    return {"status": f"""
+    for an agent called {agent_name}, drafted an agent schema in {schema_filename},  
+    a lambda function called {lambda_function_name}, 
+    test payloads called {test_payloads_filename},
+    created an agent with id {agent_id} and 
+    attached an IAM role {agent_role_name} to it
+    with access to {s3_bucket} S3 bucket,
+    lambda function {lambda_function_name} and bedrock models;
+    finally created an alias called {agent_alias_name} with 
+    {alias_id} id for agent {agent_name} and prepared 
+    the agent to be used. 
+    Files were saved in s3://{s3_bucket}/{base_key}/
+    """
+            }
 
-    # Pause to make sure iam roles are created
-    time.sleep(10)
 
+def create_agent_resources(timings, agent_name, s3_bucket, schema_key, agent_instruction, account_id,
+                           agent_alias_name, lambda_function_name, lambda_function_code, lambda_role_arn,
+                           agent_role_name, agent_role_arn, bedrock_agent_bedrock_allow_policy_name,
+                           bedrock_agent_s3_allow_policy_name, bedrock_agent_lambda_allow_policy_name):
+    """Creates the action group Lambda, the agent policies, the agent and its alias, returns (agent id, alias id)."""
     print(
         f'Creating an actual Lambda function called {lambda_function_name}...')
-    lambda_arn = create_lambda_function(lambda_function_name,
-                           lambda_function_code, lambda_role_arn)
+    # Retried until Lambda can assume the role that was just created
+    lambda_arn = timings.timed('lambda function', waiters.call_with_retry,
+        lambda: create_lambda_function(lambda_function_name, lambda_function_code, lambda_role_arn),
+        f'create Lambda function {lambda_function_name}')
     
     print(
         f"""Creating Bedrock policy called {bedrock_agent_bedrock_allow_policy_name}
@@ -354,16 +435,14 @@ def draft_and_create_agent(event, context):
         )
     (bedrock_policy_arn, 
      lambda_policy_arn, 
-     s3_policy_arn) = create_agent_policies(bedrock_policy_name=bedrock_agent_bedrock_allow_policy_name,
+     s3_policy_arn) = timings.timed('agent policies', create_agent_policies,
+                                            bedrock_policy_name=bedrock_agent_bedrock_allow_policy_name,
                                             s3_policy_name=bedrock_agent_s3_allow_policy_name,
                                             lambda_policy_name=bedrock_agent_lambda_allow_policy_name,
                                             lambda_arn=lambda_arn, 
                                             s3_bucket_name=s3_bucket,
                                             schema_key=schema_key)
 
-    # Pause to make sure iam policies are created
-    time.sleep(10)
-
     print(
         f'Attaching this policies to {agent_role_name} IAM role...')
     attach_policies_to_agent_iam_role(agent_role_name,
@@ -373,7 +452,8 @@ def draft_and_create_agent(event, context):
     
     print(
         f'Creating agent called {agent_name}...')
-    agent_id = create_agent(agent_name=agent_name,
+    agent_id = timings.timed('agent', create_agent,
+                            agent_name=agent_name,
                             agent_resource_role_arn=agent_role_arn,
                             bucket=s3_bucket,
                             model_name=AGENT_MODEL_NAME,
@@ -390,48 +470,33 @@ def draft_and_create_agent(event, context):
     print(
         f'Preparing agent with {agent_id} id ...')
     prepare_agent(agent_id=agent_id)
-
-    # Pause to make sure agent is in prepared state
-    time.sleep(7)
+    timings.timed('prepare agent', waiters.wait_for_agent_status, agent_client, agent_id, ['PREPARED'])
 
     print(
         f'Creating an alias for an agent with {agent_id} id ...')
     alias_id = create_agent_alias(agent_id=agent_id, alias_name=agent_alias_name)
-    
 
-    return {"status": f"""
-    for an agent called {agent_name}, drafted an agent schema in {schema_filename},  
-    a lambda function called {lambda_function_name}, 
-    test payloads called {test_payloads_filename},
-    created an agent with id {agent_id} and 
-    attached an IAM role {agent_role_name} to it
-    with access to {s3_bucket} S3 bucket,
-    lambda function {lambda_function_name} and bedrock models;
-    finally created an alias called {agent_alias_name} with 
-    {alias_id} id for agent {agent_name} and prepared 
-    the agent to be used. 
-    Files were saved in s3://{s3_bucket}/{base_key}/
-    """
-            }
+    return agent_id, alias_id
 
 
 def create_agent(bucket, agent_resource_role_arn,
                  lambda_arn, agent_name, key, model_name,
                  instruction):
 
-    response = agent_client.create_agent(
-        agentName=agent_name,
-        agentResourceRoleArn=agent_resource_role_arn,
-        foundationModel=model_name,
-        description="Agent created by another agent based on user request.",
-        idleSessionTTLInSeconds=1800,
-        instruction=instruction,
-    )
+    # Retried until Bedrock accepts the role that was just created
+    response = waiters.call_with_retry(
+        lambda: agent_client.create_agent(
+            agentName=agent_name,
+            agentResourceRoleArn=agent_resource_role_arn,
+            foundationModel=model_name,
+            description="Agent created by another agent based on user request.",
+            idleSessionTTLInSeconds=1800,
+            instruction=instruction,
+        ),
+        f'create agent {agent_name}')
 
     agent_id = response['agent']['agentId']
-
-    # Pause to make sure agents has been created
-    time.sleep(10)
+    waiters.wait_for_agent_status(agent_client, agent_id, ['NOT_PREPARED'])
 
     agent_client.create_agent_action_group(
         agentId=agent_id,
@@ -0,0 +1,46 @@
+"""
+Prompt templates parsed once, at cold start, into literal text and placeholder slots and rendered with a single join,
+instead of one str.replace pass over the whole template per placeholder on every request.
+
+Only the declared names are placeholders, so braces elsewhere in a template (JSON, code examples) are kept as is.
+Values are inserted verbatim and never scanned for placeholders themselves.
+"""
+import re
+
+
+class PromptTemplate:
+    def __init__(self, text, names, placeholder='{%s}'):
+        """
+        Args:
+            text (str): the template
+            names (list): placeholder names, each one must appear in text at least once
+            placeholder (str): how a name is written in the template, '{%s}' matches {agent_name}
+        """
+        self.names = frozenset(names)
+        by_placeholder = {placeholder % name: name for name in self.names}
+        if by_placeholder:
+            # longest first, so a placeholder that is a prefix of another does not shadow it
+            pattern = '|'.join(re.escape(p) for p in sorted(by_placeholder, key=len, reverse=True))
+            # with a capturing group re.split keeps the separators: literals at even, placeholders at odd indexes
+            self.parts = re.split(f'({pattern})', text)
+        else:
+            self.parts = [text]
+        self.slots = [(i, by_placeholder[self.parts[i]]) for i in range(1, len(self.parts), 2)]
+        missing = self.names - {name for _, name in self.slots}
+        if missing:
+            raise ValueError(f'placeholders not found in template: {sorted(placeholder % name for name in missing)}')
+
+    @classmethod
+    def from_file(cls, path, names, placeholder='{%s}'):
+        with open(path) as f:
+            return cls(f.read(), names, placeholder)
+
+    def render(self, values):
+        """Returns the template with every placeholder replaced by values[name], raises KeyError on a missing or unknown name."""
+        if values.keys() != self.names:
+            missing, unknown = self.names - values.keys(), values.keys() - self.names
+            raise KeyError(f'missing values for {sorted(missing)}' if missing else f'unknown placeholders {sorted(unknown)}')
+        parts = self.parts.copy()
+        for i, name in self.slots:
+            parts[i] = values[name]
+        return ''.join(parts)
@@ -0,0 +1,114 @@
+"""
+AWS clients created once per container and shared by every request, instead of per request or per call:
+- connection pools sized to the concurrency of the caller (max_pool_connections, botocore keeps only 10 by default)
+- TCP keep-alive on the pooled connections, so idle ones survive between invocations
+- standard retries by default, adaptive (client side rate limiting on throttling) on request; with one client per
+  container the adaptive rate limiter sees all the calls of the container
+- an aiobotocore variant with the same settings, for handlers that fan out with asyncio
+
+Clients are thread safe and shared between threads, resources are not and every thread gets its own.
+The retry mode default can be changed with the AWS_RETRY_MODE environment variable, like for boto3 itself.
+"""
+import os
+import asyncio
+import threading
+import contextlib
+
+import boto3
+from botocore.config import Config
+
+RETRY_MODE = os.environ.get('AWS_RETRY_MODE', 'standard')
+# connections kept per client when the caller does not say how many calls it makes at once
+DEFAULT_MAX_CONCURRENCY = 10
+
+# boto3's default session is not thread safe to create clients from
+session = boto3.session.Session()
+lock = threading.Lock()
+clients = {}
+thread_local = threading.local()
+
+
+def config(max_concurrency=None, retry_mode=None, **options):
+    """
+    The botocore Config of the shared clients
+    Args:
+        max_concurrency (int): calls made at the same time with the client, one pooled connection each
+        retry_mode (str): 'standard' or 'adaptive', RETRY_MODE by default
+        options: other Config options, e.g. connect_timeout=60
+    """
+    return Config(
+        max_pool_connections=max(max_concurrency or 0, DEFAULT_MAX_CONCURRENCY),
+        tcp_keepalive=True,
+        retries={'mode': retry_mode or RETRY_MODE},
+        **options,
+    )
+
+
+def client(service_name, region_name=None, max_concurrency=None, retry_mode=None, endpoint_url=None, **options):
+    """
+    The client of service_name shared by the container, created on first use. Callers asking for the same service
+    with different settings get different clients. endpoint_url is for local testing, e.g. DynamoDB Local.
+    """
+    key = (service_name, region_name, max_concurrency, retry_mode, endpoint_url, tuple(sorted(options.items())))
+    with lock:
+        if key not in clients:
+            clients[key] = session.client(service_name, region_name=region_name, endpoint_url=endpoint_url,
+                                          config=config(max_concurrency, retry_mode, **options))
+        return clients[key]
+
+
+def resource(service_name, region_name=None, retry_mode=None, endpoint_url=None, **options):
+    """
+    The resource of service_name of the calling thread, created on first use with its own session
+    """
+    key = (service_name, region_name, retry_mode, endpoint_url, tuple(sorted(options.items())))
+    resources = thread_local.__dict__.setdefault('resources', {})
+    if key not in resources:
+        resources[key] = boto3.session.Session().resource(service_name, region_name=region_name,
+                                                          endpoint_url=endpoint_url,
+                                                          config=config(None, retry_mode, **options))
+    return resources[key]
+
+
+# aiobotocore clients are bound to the event loop they are created on: the async clients and the loop they run on
+# are both kept for the life of the container, handlers run their coroutines with run()
+async_loop = None
+async_clients = {}
+async_exit_stack = contextlib.AsyncExitStack()
+
+
+def run(coroutine):
+    """
+    Run a coroutine on the event loop of the async clients, the asyncio.run of handlers using async_client
+    """
+    global async_loop
+    if async_loop is None:
+        async_loop = asyncio.new_event_loop()
+    return async_loop.run_until_complete(coroutine)
+
+
+async def async_client(service_name, region_name=None, max_concurrency=None, retry_mode=None, endpoint_url=None,
+                       **options):
+    """
+    The aiobotocore client of service_name shared by the container, created on first use, with the settings of
+    client(). Needs aiobotocore in the deployment package or a layer, and must be awaited from run().
+    """
+    from aiobotocore.config import AioConfig
+    from aiobotocore.session import get_session
+
+    key = (service_name, region_name, max_concurrency, retry_mode, endpoint_url, tuple(sorted(options.items())))
+    if key not in async_clients:
+        # a task, so that coroutines asking for the client at the same time wait for the same one
+        async_clients[key] = asyncio.ensure_future(async_exit_stack.enter_async_context(get_session().create_client(
+            service_name,
+            region_name=region_name,
+            endpoint_url=endpoint_url,
+            config=AioConfig(
+                max_pool_connections=max(max_concurrency or 0, DEFAULT_MAX_CONCURRENCY),
+                # aiohttp keeps the pooled connections alive, for this long once idle
+                connector_args={'keepalive_timeout': 60},
+                retries={'mode': retry_mode or RETRY_MODE},
+                **options,
+            ),
+        )))
+    return await async_clients[key]
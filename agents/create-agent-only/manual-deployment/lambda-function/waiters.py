@@ -0,0 +1,117 @@
+"""
+Waiters for agent provisioning: poll the actual status of a resource instead of sleeping a fixed time.
+
+Polls back off exponentially with full jitter, so a resource that is ready right away costs one call and a
+slow one is not hammered. Every waiter gives up with WaiterTimeout after `timeout` seconds.
+"""
+import random
+import time
+
+from botocore.exceptions import ClientError
+
+
+class WaiterTimeout(Exception):
+    pass
+
+
+class WaiterFailed(Exception):
+    pass
+
+
+def backoff_delays(initial_delay=0.5, max_delay=10.0, factor=2.0):
+    """Full jitter: a random delay between 0 and an exponentially growing cap."""
+    cap = initial_delay
+    while True:
+        yield random.uniform(0, cap)
+        cap = min(cap * factor, max_delay)
+
+
+def wait_until(check, description, timeout=300, initial_delay=0.5, max_delay=10.0):
+    """Calls check() until it returns something truthy and returns that, check() raises WaiterFailed to stop early."""
+    deadline = time.monotonic() + timeout
+    delays = backoff_delays(initial_delay, max_delay)
+    attempts = 0
+    while True:
+        attempts += 1
+        result = check()
+        if result:
+            print(f'{description}: ready after {attempts} checks')
+            return result
+        delay = next(delays)
+        if time.monotonic() + delay > deadline:
+            raise WaiterTimeout(f'{description}: not ready after {timeout}s')
+        time.sleep(delay)
+
+
+def is_iam_propagation_error(error):
+    """
+    IAM is eventually consistent: another service may reject a role or policy created a moment ago, for
+    example "The role defined for the function cannot be assumed by Lambda" or "... is not authorized to ...".
+    """
+    if not isinstance(error, ClientError):
+        return False
+    code = error.response['Error']['Code']
+    message = error.response['Error'].get('Message', '').lower()
+    return (code in ('ValidationException', 'AccessDeniedException', 'InvalidParameterValueException')
+            and any(word in message for word in ('role', 'assume', 'not authorized', 'permission')))
+
+
+def is_throttling_error(error):
+    return isinstance(error, ClientError) and error.response['Error']['Code'] in (
+        'ThrottlingException', 'TooManyRequestsException', 'Throttling', 'RequestLimitExceeded')
+
+
+def call_with_retry(fn, description, retryable=is_iam_propagation_error, timeout=120, initial_delay=1.0, max_delay=10.0):
+    """Calls fn() until it no longer raises a retryable error, returns its result."""
+    failure = []
+
+    def attempt():
+        try:
+            return (fn(),)
+        except Exception as error:
+            if not retryable(error):
+                raise
+            print(f'{description}: retrying after {error}')
+            failure[:] = [error]
+            return None
+
+    try:
+        return wait_until(attempt, description, timeout, initial_delay, max_delay)[0]
+    except WaiterTimeout as timeout_error:
+        raise failure[0] if failure else timeout_error
+
+
+def wait_for_agent_status(agent_client, agent_id, statuses, timeout=300):
+    """Waits until get_agent reports one of statuses, e.g. NOT_PREPARED after create_agent or PREPARED after prepare_agent."""
+    def check():
+        agent = agent_client.get_agent(agentId=agent_id)['agent']
+        if agent['agentStatus'] == 'FAILED':
+            raise WaiterFailed(f'agent {agent_id} failed: {agent.get("failureReasons")}')
+        return agent['agentStatus'] in statuses
+
+    return wait_until(check, f'agent {agent_id} {"/".join(statuses)}', timeout)
+
+
+def wait_for_agent_aliases_deleted(agent_client, agent_id, alias_ids=None, timeout=300):
+    """Waits until the aliases in alias_ids, or all aliases of the agent when None, are gone."""
+    def check():
+        remaining = [alias['agentAliasId'] for alias in agent_client.list_agent_aliases(agentId=agent_id)['agentAliasSummaries']]
+        return not [alias_id for alias_id in remaining if alias_ids is None or alias_id in alias_ids]
+
+    return wait_until(check, f'aliases of agent {agent_id} deleted', timeout)
+
+
+def wait_for_collection_active(opensearch_serverless_client, name, timeout=900):
+    """Waits until the OpenSearch Serverless collection is ACTIVE, returns its details."""
+    def check():
+        details = opensearch_serverless_client.batch_get_collection(names=[name])['collectionDetails']
+        if details and details[0]['status'] == 'FAILED':
+            raise WaiterFailed(f'collection {name} failed')
+        return details[0] if details and details[0]['status'] == 'ACTIVE' else None
+
+    # collections take minutes, no point checking more often than every 15s once the backoff has grown
+    return wait_until(check, f'collection {name} active', timeout, initial_delay=2.0, max_delay=15.0)
+
+
+def wait_for_index(opensearch_client, index, timeout=120):
+    return wait_until(lambda: opensearch_client.indices.exists(index=index), f'index {index} exists', timeout)
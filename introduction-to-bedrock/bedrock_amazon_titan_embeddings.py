@@ -1,5 +1,10 @@
 import boto3
 import json
+import os
+import sys
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "rag-solutions", "embedding-cache"))
+from embedding_cache import EmbeddingCache, LRUBackend, cached_invoke_model
 
 #Create the connection to Bedrock
 bedrock = boto3.client(
@@ -46,4 +51,14 @@ embedding = response_body.get('embedding')
 
 #Print the Embedding
 
-print(embedding)
\ No newline at end of file
+print(embedding)
+
+# Embeddings are deterministic, so callers that embed the same text repeatedly can answer from a cache
+# keyed by (modelId, normalized input) instead of paying for another invoke_model call.
+# See rag-solutions/embedding-cache for the LRU, SQLite and DynamoDB backends.
+cache = EmbeddingCache(LRUBackend())
+for _ in range(3):
+    embedding = cached_invoke_model(cache, bedrock_runtime, model_id, {"inputText": prompt_data})
+
+# Only the first call reached Bedrock
+print(cache.stats)
@@ -0,0 +1,127 @@
+"""
+Cold start (init duration) of the emails processing Lambda before and after moving boto3 to a layer, measured with the
+Lambda Runtime Interface Emulator that ships in the AWS Lambda base image:
+
+    python benchmark_cold_start.py --runs 5
+
+"before" is the current lambda_function.py with the pip install it used to run at import time put back in front,
+"after" is lambda_function.py as deployed, with the bedrock_boto3_layer requirements installed into /opt/python.
+Every run starts a fresh container, invokes the function once and reads "Init Duration" from the REPORT line the
+emulator logs. The invocation itself fails (no DynamoDB behind the dummy endpoint), only the init is measured.
+Needs Docker; the "before" variant needs network access from the container, like the Lambda did.
+"""
+import os
+import re
+import sys
+import json
+import time
+import shutil
+import socket
+import argparse
+import tempfile
+import statistics
+import subprocess
+import urllib.error
+import urllib.request
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FUNCTION_DIR = os.path.join(HERE, "process_dynamodb_table_bedrock", "process_dynamodb_table_bedrock_lambda")
+LAYER_REQUIREMENTS = os.path.join(HERE, "process_dynamodb_table_bedrock", "bedrock_boto3_layer", "requirements.txt")
+IMAGE = "public.ecr.aws/lambda/python:3.9"
+
+# What lambda_function.py ran at import time before the layer
+PIP_INSTALL_PREAMBLE = """import sys
+from pip._internal import main
+main(['install', '-I', '-q', 'boto3', '--target', '/tmp/', '--no-cache-dir', '--disable-pip-version-check'])
+sys.path.insert(0, '/tmp/')
+"""
+
+ENVIRONMENT = {
+    "emails_data_table": "EmailsData",
+    "information_extracted_table": "EmailsInformationExtracted",
+    "information_extracted_table_partition_key": "thread_id",
+    "region": "us-east-1",
+    "AWS_REGION": "us-east-1",
+    "AWS_ACCESS_KEY_ID": "benchmark",
+    "AWS_SECRET_ACCESS_KEY": "benchmark",
+    "AWS_ENDPOINT_URL": "http://127.0.0.1:9",  # fail fast instead of calling AWS
+}
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def prepare(work_dir):
+    """Returns {variant: (function dir, layer dir or None)}."""
+    before = os.path.join(work_dir, "before")
+    shutil.copytree(FUNCTION_DIR, before)
+    with open(os.path.join(before, "lambda_function.py")) as f:
+        source = f.read()
+    with open(os.path.join(before, "lambda_function.py"), "w") as f:
+        f.write(PIP_INSTALL_PREAMBLE + source)
+
+    layer = os.path.join(work_dir, "layer")
+    # same command as the CDK bundling of the layer, in the same image family
+    subprocess.run(["docker", "run", "--rm", "--entrypoint", "pip", "-v", f"{os.path.dirname(LAYER_REQUIREMENTS)}:/src:ro",
+                    "-v", f"{layer}:/out", IMAGE, "install", "--no-cache-dir", "-q", "-r", "/src/requirements.txt",
+                    "-t", "/out/python"], check=True)
+    return {"before": (before, None), "after": (FUNCTION_DIR, layer)}
+
+
+def cold_start(function_dir, layer_dir, timeout):
+    port = free_port()
+    command = ["docker", "run", "-d", "--rm", "-p", f"127.0.0.1:{port}:8080", "-v", f"{function_dir}:/var/task:ro"]
+    if layer_dir:
+        command += ["-v", f"{layer_dir}:/opt:ro"]
+    for key, value in ENVIRONMENT.items():
+        command += ["-e", f"{key}={value}"]
+    container = subprocess.run(command + [IMAGE, "lambda_function.lambda_handler"],
+                               check=True, capture_output=True, text=True).stdout.strip()
+    try:
+        url = f"http://127.0.0.1:{port}/2015-03-31/functions/function/invocations"
+        deadline = time.monotonic() + 30
+        while True:
+            try:
+                st = time.perf_counter()
+                urllib.request.urlopen(url, json.dumps({"thread_id": "1"}).encode(), timeout=timeout).read()
+                break
+            except (urllib.error.URLError, ConnectionError):  # the emulator is not listening yet
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.2)
+        first_invoke = time.perf_counter() - st
+        logs = subprocess.run(["docker", "logs", container], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True).stdout
+        init = re.search(r"Init Duration: ([\d.]+) ms", logs)
+        return (float(init.group(1)) / 1000 if init else None), first_invoke
+    finally:
+        subprocess.run(["docker", "stop", container], capture_output=True)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--timeout", type=float, default=300)
+    args = parser.parse_args()
+
+    subprocess.run(["docker", "pull", "-q", IMAGE], check=True, stdout=subprocess.DEVNULL)
+    work_dir = tempfile.mkdtemp(prefix="cold-start-")
+    try:
+        variants = prepare(work_dir)
+        print(f"{'variant':<10}{'init s (median)':>18}{'init s (max)':>15}{'first invoke s':>17}")
+        for name, (function_dir, layer_dir) in variants.items():
+            runs = [cold_start(function_dir, layer_dir, args.timeout) for _ in range(args.runs)]
+            inits = [init for init, _ in runs if init is not None]
+            if not inits:
+                print(f"{name:<10} no Init Duration in the emulator logs", file=sys.stderr)
+                continue
+            print(f"{name:<10}{statistics.median(inits):>18.2f}{max(inits):>15.2f}"
+                  f"{statistics.median(invoke for _, invoke in runs):>17.2f}")
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
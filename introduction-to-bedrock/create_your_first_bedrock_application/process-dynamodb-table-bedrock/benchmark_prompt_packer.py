@@ -0,0 +1,85 @@
+"""
+Prompt size and build time of the emails of long threads, comparing the string concatenation create_emails_tags used
+before (every email in full, quoted replies included) with prompt_packer.pack_thread, which drops the quoted reply
+chains and shortens or leaves out the oldest emails to stay under the token budget:
+
+    python benchmark_prompt_packer.py --messages 10000 --budget 80000
+
+Every reply of the generated thread quotes the --quoted emails before it, the way mail clients do.
+Tokens are estimated with prompt_packer.estimate_tokens for every variant.
+"""
+import os
+import sys
+import random
+import timeit
+import argparse
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "process_dynamodb_table_bedrock",
+                                "process_dynamodb_table_bedrock_lambda"))
+from prompt_packer import estimate_tokens, pack_thread
+
+WORDS = ["parcel", "weight", "300g", "Seattle", "Denver", "price", "delivery", "Monday", "please", "confirm",
+         "address", "123", "Main", "Street", "USD", "thanks", "the", "of", "to", "and"]
+
+
+def build_thread(messages, quoted, words, rng):
+    emails, written = [], []
+    for i in range(messages):
+        text = "\n".join(" ".join(rng.choice(WORDS) for _ in range(12)) for _ in range(max(1, words // 12)))
+        written.append(f"Dear customer,\n{text}\nBest regards,\nJane Doe")
+        body = written[-1]
+        if i:
+            # what the last emails added, newest first, as nested quotes
+            quote = "\n".join("> " * depth + line for depth, previous in enumerate(reversed(written[-1 - quoted:-1]), 1)
+                              for line in previous.split("\n"))
+            body += f"\n\nOn Mon, Jan {1 + i % 28}, 2024 at 10:{i % 60:02d} John <john@example.com> wrote:\n{quote}"
+        emails.append({"date": f"2024-01-{1 + i * 28 // messages:02d}", "time": f"{i // 60 % 24:02d}:{i % 60:02d}:00",
+                       "subject": f"Parcel shipment request {i}", "message": body})
+    return emails
+
+
+def concatenate(items):
+    """create_emails_tags before the packer"""
+    emails_tag = "<emails>\n"
+    for item in items:
+        emails_tag += "\t<email>\n"
+        emails_tag += "\t\t<date>" + item["date"] + " " + item["time"] + "</date>\n"
+        emails_tag += "\t\t<subject>" + item["subject"] + "</subject>\n"
+        emails_tag += "\t\t<message>\n" + item["message"] + "\n</message>\n"
+        emails_tag += "\t</email>\n"
+    emails_tag += "</emails>"
+    return emails_tag
+
+
+def render_email_tag(item, message):
+    return "".join(["\t<email>\n", "\t\t<date>", item["date"], " ", item["time"], "</date>\n",
+                    "\t\t<subject>", item["subject"], "</subject>\n", "\t\t<message>\n", message, "\n</message>\n",
+                    "\t</email>\n"])
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--messages", type=int, default=10_000, help="emails in the thread")
+    parser.add_argument("--words", type=int, default=80, help="words written in each email")
+    parser.add_argument("--quoted", type=int, default=3, help="earlier emails quoted by each reply")
+    parser.add_argument("--budget", type=int, default=80_000, help="token budget of pack_thread")
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    emails = build_thread(args.messages, args.quoted, args.words, random.Random(0))
+    cases = {
+        "concatenation": lambda: concatenate(emails),
+        "pack_thread, no budget": lambda: "<emails>\n" + pack_thread(emails, render_email_tag, float("inf")).text,
+        f"pack_thread, {args.budget}": lambda: "<emails>\n" + pack_thread(emails, render_email_tag, args.budget).text,
+    }
+    print(f"{args.messages} emails of {args.words} words, each quoting {args.quoted}")
+    print(f"{'build':<26}{'ms':>10}{'chars':>14}{'est. tokens':>14}")
+    for name, fn in cases.items():
+        seconds = min(timeit.repeat(fn, number=1, repeat=args.repeat))
+        text = fn()
+        print(f"{name:<26}{seconds * 1000:>10.1f}{len(text):>14}{estimate_tokens(text):>14}")
+    print(pack_thread(emails, render_email_tag, args.budget))
+
+
+if __name__ == "__main__":
+    main()
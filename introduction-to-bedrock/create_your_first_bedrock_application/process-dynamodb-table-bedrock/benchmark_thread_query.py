@@ -0,0 +1,144 @@
+"""
+Time to read the emails of one thread from an emails table of N items on DynamoDB Local, comparing the previous
+scan with a filter on thread_id (one page, as create_emails_tags did, and every page, which is what a correct scan
+costs) with the query on the ThreadIndex GSI that create_emails_tags uses now:
+
+    docker run -d -p 8000:8000 amazon/dynamodb-local -jar DynamoDBLocal.jar -inMemory -sharedDb
+    python benchmark_thread_query.py --emails 1000000
+
+The table is created with the same keys and index as process_dynamodb_table_bedrock_stack.py and loaded once,
+later runs with the same --table reuse it (--emails is only used to load it).
+"""
+import os
+import sys
+import time
+import random
+import argparse
+import functools
+import statistics
+import concurrent.futures
+
+import boto3
+from boto3.dynamodb.conditions import Attr
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LAMBDA_DIR = os.path.join(HERE, "process_dynamodb_table_bedrock", "process_dynamodb_table_bedrock_lambda")
+THREAD_INDEX = "ThreadIndex"
+
+
+def create_table(dynamodb, name):
+    try:
+        dynamodb.create_table(
+            TableName=name,
+            KeySchema=[{"AttributeName": "email_id", "KeyType": "HASH"}],
+            AttributeDefinitions=[{"AttributeName": "email_id", "AttributeType": "N"},
+                                  {"AttributeName": "thread_id", "AttributeType": "N"},
+                                  {"AttributeName": "date", "AttributeType": "S"}],
+            GlobalSecondaryIndexes=[{
+                "IndexName": THREAD_INDEX,
+                "KeySchema": [{"AttributeName": "thread_id", "KeyType": "HASH"}, {"AttributeName": "date", "KeyType": "RANGE"}],
+                "Projection": {"ProjectionType": "INCLUDE", "NonKeyAttributes": ["time", "subject", "message"]},
+            }],
+            BillingMode="PAY_PER_REQUEST",
+        )
+        return True
+    except dynamodb.meta.client.exceptions.ResourceInUseException:
+        return False
+
+
+def load_emails(resource, name, start, stop, emails_per_thread):
+    rng = random.Random(start)
+    with resource.Table(name).batch_writer() as batch:
+        for email_id in range(start, stop):
+            batch.put_item(Item={
+                "email_id": email_id,
+                "thread_id": email_id // emails_per_thread,
+                "thread_email_id": email_id % emails_per_thread,
+                "date": f"2023-{1 + email_id % 12:02d}-{1 + rng.randrange(28):02d}",
+                "time": f"{rng.randrange(24):02d}:{rng.randrange(60):02d}:00",
+                "subject": f"Parcel shipment request {email_id // emails_per_thread}",
+                "message": "Dear customer,\n" + " ".join(rng.choice(["parcel", "weight", "300g", "Seattle", "Denver", "price"])
+                                                         for _ in range(80)),
+            })
+
+
+def previous_scan(table, thread_id, all_pages):
+    """The previous create_emails_tags read: a filtered scan, by default only its first page."""
+    scan = dict(FilterExpression=Attr("thread_id").eq(int(thread_id)), ReturnConsumedCapacity="TOTAL")
+    items, capacity = [], 0
+    while True:
+        response = table.scan(**scan)
+        items += response["Items"]
+        capacity += response.get("ConsumedCapacity", {}).get("CapacityUnits", 0)
+        if not all_pages or "LastEvaluatedKey" not in response:
+            return len(items), capacity
+        scan["ExclusiveStartKey"] = response["LastEvaluatedKey"]
+
+
+def measure(fn, thread_ids):
+    latencies, found = [], []
+    for thread_id in thread_ids:
+        st = time.perf_counter()
+        found.append(fn(thread_id))
+        latencies.append((time.perf_counter() - st) * 1000)
+    return statistics.mean(latencies), max(latencies), found
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--endpoint-url", default="http://localhost:8000")
+    parser.add_argument("--table", default="EmailsDataBenchmark")
+    parser.add_argument("--emails", type=int, default=1_000_000)
+    parser.add_argument("--emails-per-thread", type=int, default=5)
+    parser.add_argument("--lookups", type=int, default=20)
+    parser.add_argument("--scan-lookups", type=int, default=3, help="full scans are slow, fewer of them")
+    parser.add_argument("--loaders", type=int, default=16)
+    args = parser.parse_args()
+
+    os.environ.setdefault("AWS_ACCESS_KEY_ID", "local")
+    os.environ.setdefault("AWS_SECRET_ACCESS_KEY", "local")
+    os.environ.setdefault("AWS_DEFAULT_REGION", "us-east-1")
+    resource = functools.partial(boto3.resource, endpoint_url=args.endpoint_url)
+    dynamodb = resource("dynamodb")
+    if create_table(dynamodb.meta.client, args.table):
+        dynamodb.meta.client.get_waiter("table_exists").wait(TableName=args.table)
+        print(f"loading {args.emails} emails into {args.table}")
+        st = time.perf_counter()
+        step = -(-args.emails // args.loaders)
+        with concurrent.futures.ThreadPoolExecutor(args.loaders) as pool:
+            # boto3 resources are not thread safe, one per loader
+            list(pool.map(lambda start: load_emails(resource("dynamodb"), args.table, start, min(start + step, args.emails),
+                                                    args.emails_per_thread), range(0, args.emails, step)))
+        print(f"loaded in {time.perf_counter() - st:.0f}s")
+    emails = dynamodb.meta.client.describe_table(TableName=args.table)["Table"]["ItemCount"]
+
+    os.environ.update(emails_data_table=args.table, region="us-east-1", information_extracted_table="unused",
+                      information_extracted_table_partition_key="thread_id", emails_data_table_thread_index=THREAD_INDEX)
+    sys.path.insert(0, LAMBDA_DIR)
+    cwd = os.getcwd()
+    os.chdir(LAMBDA_DIR)  # the Lambda reads prompt.txt from its working directory at import
+    import lambda_function
+    os.chdir(cwd)
+    local_table = dynamodb.Table(args.table)
+    lambda_function.get_emails_table = lambda: local_table
+
+    rng = random.Random(1)
+    threads = max(1, args.emails // args.emails_per_thread)
+    thread_ids = [str(rng.randrange(threads)) for _ in range(args.lookups)]
+    table = dynamodb.Table(args.table)
+    results = {
+        "scan, first page": measure(lambda t: previous_scan(table, t, False), thread_ids[:args.scan_lookups]),
+        "scan, all pages": measure(lambda t: previous_scan(table, t, True), thread_ids[:args.scan_lookups]),
+        "query ThreadIndex": measure(lambda t: lambda_function.create_emails_tags(t).count("<email>"), thread_ids),
+    }
+    print(f"\n{emails} emails, {args.emails_per_thread} per thread")
+    print(f"{'read':<20}{'mean ms':>12}{'max ms':>12}{'emails found':>14}{'RCU':>10}")
+    for name, (mean, worst, found) in results.items():
+        counts = [f[0] if isinstance(f, tuple) else f for f in found]
+        capacity = statistics.mean(f[1] for f in found) if isinstance(found[0], tuple) else None
+        print(f"{name:<20}{mean:>12.1f}{worst:>12.1f}{statistics.mean(counts):>14.1f}"
+              f"{f'{capacity:.0f}' if capacity is not None else '':>10}")
+
+
+if __name__ == "__main__":
+    main()
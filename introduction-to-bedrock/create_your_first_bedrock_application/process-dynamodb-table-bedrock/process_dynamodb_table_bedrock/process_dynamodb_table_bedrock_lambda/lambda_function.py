@@ -1,100 +1,166 @@
-# installing the latest version of pip for bedrock support. The next 4 lines can be removed once the Lambda version of boto3 is updated
-import sys
-from pip._internal import main
-main(['install', '-I', '-q', 'boto3', '--target', '/tmp/', '--no-cache-dir', '--disable-pip-version-check'])
-sys.path.insert(0, '/tmp/')
-
+# boto3 with Bedrock support comes from the bedrock_boto3_layer layer (see process_dynamodb_table_bedrock_stack.py),
+# layers are extracted to /opt/python, ahead of the runtime's own boto3 on sys.path
 import json
-import boto3
-from botocore.config import Config
+import time
 from boto3.dynamodb.conditions import Key, Attr
+from botocore.exceptions import BotoCoreError, ClientError
 import os
+import concurrent.futures
+import aws_clients
+from prompt_packer import pack_thread
+from prompt_template import PromptTemplate
 
 # getting the dynamoDB tables, partition keys and AWS region from OS environment
 emails_data_table = os.environ['emails_data_table']
 region = os.environ['region']
 information_extracted_table = os.environ['information_extracted_table']
 information_extracted_table_partition_key = os.environ['information_extracted_table_partition_key']
+emails_data_table_thread_index = os.environ.get('emails_data_table_thread_index', 'ThreadIndex')
+
+# number of threads processed at the same time in batch mode, i.e. concurrent Bedrock calls
+max_concurrent_threads = int(os.environ.get('max_concurrent_threads', '8'))
+
+# estimated tokens of the emails of a thread in the prompt, Claude v2 reads 100k tokens including the instructions,
+# longer threads are shortened starting with their oldest emails
+prompt_token_budget = int(os.environ.get('prompt_token_budget', '80000'))
+
+# parse the prompt template once per cold start, {emails} is replaced by the emails of the thread
+prompt_template = PromptTemplate.from_file("prompt.txt", ["emails"])
+
+# clients are created once per cold start and shared by the requests (and the threads of batch mode) of this container,
+# see aws_clients.py
+bedrock_client = aws_clients.client(
+    "bedrock-runtime",
+    region_name=region,
+    max_concurrency=max_concurrent_threads,
+    retry_mode="adaptive",
+    connect_timeout=60,
+)
+dynamodb_client = aws_clients.client('dynamodb', max_concurrency=max_concurrent_threads)
+
+
+def get_emails_table():
+    # boto3 resources are not thread safe, every thread gets its own emails table
+    return aws_clients.resource('dynamodb').Table(emails_data_table)
 
 
 def create_emails_tags(thread_id):
     """
     Create the email's context information to be used in the Bedrock prompt.
     This function:
-    1. Queries the DynamoDB table containing the emails data by the ThreadID
-    2. For each email in the Tread, create an email tag for the Bedrock Prompt
+    1. Queries the thread index (ThreadID, date) of the DynamoDB table containing the emails data, page by page
+    2. For each email in the Tread, create an email tag for the Bedrock Prompt, see prompt_packer.pack_thread
     Args:
         thread_id (int): the id of the thread to process
     Returns:
         emails_tag (str): the xml tags for the emails data to be used in the prompt
     """
-    dynamodb = boto3.resource('dynamodb')
-    table = dynamodb.Table(emails_data_table)
+    table = get_emails_table()
 
-    response = table.scan(
-        FilterExpression=Attr(information_extracted_table_partition_key).eq(int(thread_id))
+    # only the thread's emails are read, and only the attributes used below
+    query = dict(
+        IndexName=emails_data_table_thread_index,
+        KeyConditionExpression=Key(information_extracted_table_partition_key).eq(int(thread_id)),
+        ProjectionExpression="#date, #time, subject, message",
+        ExpressionAttributeNames={"#date": "date", "#time": "time"},
     )
-    items = sorted(response['Items'], key=lambda x: int(x[information_extracted_table_partition_key]))
-    emails_tag = "<emails>\n"
-    for item in items:
-        emails_tag += "\t<email>\n"
-        emails_tag += "\t\t<date>" + item["date"] + " " + item["time"] + "</date>\n"
-        emails_tag += "\t\t<subject>" + item["subject"] + "</subject>\n"
-        emails_tag += "\t\t<message>\n" + item["message"] + "\n</message>\n"
-        emails_tag += "\t</email>\n"
-    emails_tag += "</emails>"
-    return emails_tag
+    items = []
+    while True:
+        # a query returns at most 1 MB, follow LastEvaluatedKey so long threads are not cut off
+        response = table.query(**query)
+        items += response['Items']
+        if 'LastEvaluatedKey' not in response:
+            break
+        query['ExclusiveStartKey'] = response['LastEvaluatedKey']
+    # the index is sorted by date, emails of the same day are ordered by time
+    items.sort(key=lambda x: (x["date"], x["time"]))
+    # without the quoted replies and under the token budget
+    packed = pack_thread(items, render_email_tag, prompt_token_budget, omitted_note="\t<omitted>{} earlier emails</omitted>\n")
+    print(f"Thread {thread_id}: {packed}")
+    return "".join(["<emails>\n", packed.text, "</emails>"])
 
 
-def save_extracted_info(extracted_info, thread_id):
+def render_email_tag(item, message):
     """
-    This function save the extracted information to the dynamoDB table containing the processed email's data
+    The prompt tag of an email of the thread, with its message as given (deduplicated or shortened)
+    """
+    return "".join([
+        "\t<email>\n",
+        "\t\t<date>", item["date"], " ", item["time"], "</date>\n",
+        "\t\t<subject>", item["subject"], "</subject>\n",
+        "\t\t<message>\n", message, "\n</message>\n",
+        "\t</email>\n",
+    ])
+
+
+def to_item(extracted_info, thread_id):
+    """
+    Convert the extracted email information to a DynamoDB item of the table containing the processed email's data
     Args:
         extracted_info (dict): dictionary containing the extracted email information from the returned bedrock query
         thread_id (int): the thread id to connect the extratect information with the email's thread
     Returns:
-        response (dict): the boto3 response from the put_item functionality
+        item (dict): the item in DynamoDB JSON
     """
-    dynamodb = boto3.client('dynamodb')
     item = {
         information_extracted_table_partition_key: {
-            "N": thread_id
+            "N": str(thread_id)
         }
     }
     for info in extracted_info:
         item[info] = {
             "S": str(extracted_info[info])
         }
+    return item
+
 
-    response = dynamodb.put_item(
+def save_extracted_info(extracted_info, thread_id):
+    """
+    This function save the extracted information to the dynamoDB table containing the processed email's data
+    Args:
+        extracted_info (dict): dictionary containing the extracted email information from the returned bedrock query
+        thread_id (int): the thread id to connect the extratect information with the email's thread
+    Returns:
+        response (dict): the boto3 response from the put_item functionality
+    """
+    response = dynamodb_client.put_item(
         TableName=information_extracted_table,
-        Item=item
+        Item=to_item(extracted_info, thread_id)
     )
     print(response)
 
 
-def lambda_handler(event, context):
-    # extract the thread id from the event
-    thread_id = event[information_extracted_table_partition_key]
+def save_extracted_infos(items, max_attempts=8):
+    """
+    Save up to 25 items with one batch_write_item, retrying the unprocessed ones with exponential backoff
+    Args:
+        items (list): items in DynamoDB JSON, see to_item, with different thread ids
+    Returns:
+        unprocessed (list): the items that could not be written after max_attempts
+    """
+    requests = [{"PutRequest": {"Item": item}} for item in items]
+    for attempt in range(max_attempts):
+        response = dynamodb_client.batch_write_item(RequestItems={information_extracted_table: requests})
+        requests = response.get("UnprocessedItems", {}).get(information_extracted_table, [])
+        if not requests:
+            return []
+        time.sleep(min(0.05 * 2 ** attempt, 5))
+    return [request["PutRequest"]["Item"] for request in requests]
 
-    # read the prompt template
-    prompt = open("prompt.txt", "r").read()
 
+def extract_thread_info(thread_id):
+    """
+    Extract the information of one email thread with Bedrock Claude V2
+    Args:
+        thread_id (int): the id of the thread to process
+    Returns:
+        completion (str): the JSON returned by the model
+    """
     # create the model prompt based on the email's data
     emails_list = create_emails_tags(thread_id)
-    prompt = prompt.replace("<emails></emails>", emails_list)
-    # print(prompt)
+    prompt = prompt_template.render({"emails": emails_list})
 
     # invoke Bedrock Claude V2 with the prompt
-    bedrock_config = Config(
-        connect_timeout=60,
-        retries={"max_attempts": 3},
-    )
-    client = boto3.client(
-        service_name="bedrock-runtime",
-        region_name=region,
-        config=bedrock_config
-    )
     payload = {
         "prompt": prompt,
         "temperature": 1,
@@ -103,19 +169,88 @@ def lambda_handler(event, context):
         "stop_sequences": ["\n\nHuman:"],
 
     }
-    bedrock_response = client.invoke_model(
+    bedrock_response = bedrock_client.invoke_model(
         body=json.dumps(payload),
         modelId="anthropic.claude-v2",
         accept="*/*",
         contentType="application/json"
     )
+    bedrock_response_body = json.loads(bedrock_response.get("body").read())
+    return bedrock_response_body["completion"]
+
+
+def process_threads(thread_ids):
+    """
+    Batch mode: extract the information of many threads, max_concurrent_threads Bedrock calls at a time, and save it
+    25 items per batch_write_item as the results come in. A thread that fails is reported and does not stop the others.
+    Args:
+        thread_ids (list): the ids of the threads to process
+    Returns:
+        report (dict): processed and failed threads and the throughput of the batch
+    """
+    st = time.perf_counter()
+    thread_ids = list(dict.fromkeys(str(thread_id) for thread_id in thread_ids))  # a batch write can not repeat a key
+    failed, pending, saved = {}, [], 0
+
+    def flush():
+        nonlocal saved
+        try:
+            unprocessed = save_extracted_infos(pending)
+        except (BotoCoreError, ClientError) as error:
+            # e.g. a validation error or throttling past the client retries: the whole batch is not saved
+            for item in pending:
+                failed[item[information_extracted_table_partition_key]["N"]] = "not saved, " + repr(error)
+            pending.clear()
+            return
+        for item in unprocessed:
+            failed[item[information_extracted_table_partition_key]["N"]] = "not saved, DynamoDB throttled the batch write"
+        saved += len(pending) - len(unprocessed)
+        pending.clear()
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max_concurrent_threads) as pool:
+        futures = {pool.submit(extract_thread_info, thread_id): thread_id for thread_id in thread_ids}
+        for future in concurrent.futures.as_completed(futures):
+            thread_id = futures[future]
+            try:
+                pending.append(to_item(json.loads(future.result()), thread_id))
+            except Exception as error:
+                failed[thread_id] = repr(error)
+            if len(pending) == 25:
+                flush()
+    if pending:
+        flush()
+
+    seconds = time.perf_counter() - st
+    report = {
+        "threads": len(thread_ids),
+        "processed": saved,
+        "failed": failed,
+        "seconds": round(seconds, 2),
+        "threads_per_second": round(len(thread_ids) / seconds, 2) if seconds else None,
+        "max_concurrent_threads": max_concurrent_threads,
+    }
+    print(json.dumps(report))
+    return report
+
+
+def lambda_handler(event, context):
+    # batch mode: {"thread_ids": [1, 2, 3]}
+    if "thread_ids" in event:
+        report = process_threads(event["thread_ids"])
+        return {
+            'statusCode': 200 if not report["failed"] else 207,
+            'body': json.dumps(report)
+        }
+
+    # extract the thread id from the event
+    thread_id = event[information_extracted_table_partition_key]
 
     # read bedrock response and save it to dynamoDB
-    bedrock_response_body = json.loads(bedrock_response.get("body").read())
-    save_extracted_info(json.loads(bedrock_response_body["completion"]), thread_id)
+    completion = extract_thread_info(thread_id)
+    save_extracted_info(json.loads(completion), thread_id)
 
     # returns the response to the user
     return {
         'statusCode': 200,
-        'body': bedrock_response_body["completion"]
+        'body': completion
     }
@@ -1,5 +1,6 @@
 from aws_cdk import (
     Stack,
+    BundlingOptions,
     aws_lambda as _lambda,
     aws_dynamodb as dynamodb,
     aws_iam as iam,
@@ -24,6 +25,21 @@ class ProcessDynamoDBTableBedrockStack(Stack):
             ),
             table_name="EmailsData"
         )
+        # index to read the emails of one thread, in date order, without scanning the table
+        emails_data_table_thread_index = "ThreadIndex"
+        emails_data_table.add_global_secondary_index(
+            index_name=emails_data_table_thread_index,
+            partition_key=dynamodb.Attribute(
+                name="thread_id",
+                type=dynamodb.AttributeType.NUMBER
+            ),
+            sort_key=dynamodb.Attribute(
+                name="date",
+                type=dynamodb.AttributeType.STRING
+            ),
+            projection_type=dynamodb.ProjectionType.INCLUDE,
+            non_key_attributes=["time", "subject", "message"]
+        )
         # create dynamoDB table for the information extracted
         information_extracted_table_partition_key = "thread_id"
         information_extracted_table = dynamodb.Table(
@@ -39,6 +55,25 @@ class ProcessDynamoDBTableBedrockStack(Stack):
         lambda_name_emails_processing = "emails-processing-app"
         lambda_name_populate_dynamodb = "populate-dynamodb-table"
 
+        # boto3 with Bedrock support, installed at synth time in the Lambda build image (needs Docker)
+        # instead of by the function itself on every cold start
+        bedrock_boto3_layer = _lambda.LayerVersion(
+            self,
+            "BedrockBoto3Layer",
+            code=_lambda.Code.from_asset(
+                "process_dynamodb_table_bedrock/bedrock_boto3_layer",
+                bundling=BundlingOptions(
+                    image=_lambda.Runtime.PYTHON_3_9.bundling_image,
+                    command=[
+                        "bash", "-c",
+                        "pip install --no-cache-dir -r requirements.txt -t /asset-output/python"
+                    ],
+                ),
+            ),
+            compatible_runtimes=[_lambda.Runtime.PYTHON_3_9],
+            description="A layer containing a boto3 version that has Bedrock",
+        )
+
         # create lambda function that handles Emails Processing requests
         emails_processing_lambda = _lambda.Function(
             self,
@@ -46,6 +81,7 @@ class ProcessDynamoDBTableBedrockStack(Stack):
             runtime=_lambda.Runtime.PYTHON_3_9,
             handler="lambda_function.lambda_handler",
             code=_lambda.Code.from_asset("process_dynamodb_table_bedrock/process_dynamodb_table_bedrock_lambda"),
+            layers=[bedrock_boto3_layer],
             function_name=lambda_name_emails_processing,
             timeout=Duration.minutes(10),
         )
@@ -82,6 +118,11 @@ class ProcessDynamoDBTableBedrockStack(Stack):
             value=self.region
         )
 
+        emails_processing_lambda.add_environment(
+            key="emails_data_table_thread_index",
+            value=emails_data_table_thread_index
+        )
+
         emails_processing_lambda.add_environment(
             key="information_extracted_table",
             value=information_extracted_table.table_name
@@ -0,0 +1,156 @@
+"""
+Latency of a handler that makes --prompts Bedrock calls and one DynamoDB batch write per invocation, like the emails
+Lambda does for a batch, against a local HTTP stub of both services answering after --latency-ms:
+
+    python benchmark_aws_clients.py --prompts 32 --invocations 50
+
+- "client per invocation": boto3 clients created in the handler, calls one after the other (the ad hoc pattern)
+- "shared, default pool": clients created once with the default Config, calls on --prompts threads; botocore keeps
+  10 connections, the others are opened and closed on every invocation
+- "aws_clients": the shared clients of aws_clients.py, pool sized to --prompts, calls on --prompts threads
+- "aws_clients async": aws_clients.async_client, calls gathered on the event loop (needs aiobotocore)
+
+The first invocation, which creates the clients, is reported apart from the warm ones.
+"""
+import os
+import sys
+import json
+import time
+import asyncio
+import argparse
+import statistics
+import threading
+import concurrent.futures
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import boto3
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "lambdas", "process_emails_with_bedrock"))
+import aws_clients
+
+BODY = json.dumps({"anthropic_version": "bedrock-2023-05-31", "prompt": "\n\nHuman: hello\n\nAssistant:",
+                   "max_tokens_to_sample": 500})
+ITEMS = [{"PutRequest": {"Item": {"MessageId": {"S": str(i)}, "Timestamp": {"S": "t"}}}} for i in range(25)]
+
+
+class Stub(BaseHTTPRequestHandler):
+    # HTTP/1.1, so that connections are kept alive like with the real endpoints
+    protocol_version = "HTTP/1.1"
+    latency = 0.0
+    connections = 0
+
+    def setup(self):
+        super().setup()
+        Stub.connections += 1
+
+    def do_POST(self):
+        self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        time.sleep(self.latency)
+        if self.path.startswith("/model/"):
+            body = json.dumps({"completion": "[]", "stop_reason": "stop_sequence"}).encode()
+            content_type = "application/json"
+        else:
+            body = json.dumps({"UnprocessedItems": {}}).encode()
+            content_type = "application/x-amz-json-1.0"
+        self.send_response(200)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+def invoke(bedrock):
+    return json.loads(bedrock.invoke_model(modelId="anthropic.claude-v2", body=BODY)["body"].read())
+
+
+def client_per_invocation(endpoint, prompts):
+    bedrock = boto3.client("bedrock-runtime", endpoint_url=endpoint)
+    dynamodb = boto3.client("dynamodb", endpoint_url=endpoint)
+    for _ in range(prompts):
+        invoke(bedrock)
+    dynamodb.batch_write_item(RequestItems={"EmailOrders": ITEMS})
+
+
+def threaded(bedrock, dynamodb, pool, prompts):
+    list(pool.map(lambda _: invoke(bedrock), range(prompts)))
+    dynamodb.batch_write_item(RequestItems={"EmailOrders": ITEMS})
+
+
+async def gathered(endpoint, prompts):
+    bedrock = await aws_clients.async_client("bedrock-runtime", max_concurrency=prompts, endpoint_url=endpoint)
+    dynamodb = await aws_clients.async_client("dynamodb", endpoint_url=endpoint)
+
+    async def invoke_async():
+        response = await bedrock.invoke_model(modelId="anthropic.claude-v2", body=BODY)
+        return json.loads(await response["body"].read())
+
+    await asyncio.gather(*(invoke_async() for _ in range(prompts)))
+    await dynamodb.batch_write_item(RequestItems={"EmailOrders": ITEMS})
+
+
+def handlers(endpoint, prompts):
+    """name -> handler, each creating its clients on first call"""
+    pool = concurrent.futures.ThreadPoolExecutor(prompts)
+    default_clients = {}
+    shared_clients = {}
+
+    def shared_default_pool():
+        if not default_clients:
+            default_clients.update(bedrock=boto3.client("bedrock-runtime", endpoint_url=endpoint),
+                                   dynamodb=boto3.client("dynamodb", endpoint_url=endpoint))
+        threaded(default_clients["bedrock"], default_clients["dynamodb"], pool, prompts)
+
+    def shared_aws_clients():
+        if not shared_clients:
+            shared_clients.update(
+                bedrock=aws_clients.client("bedrock-runtime", max_concurrency=prompts, endpoint_url=endpoint),
+                dynamodb=aws_clients.client("dynamodb", endpoint_url=endpoint))
+        threaded(shared_clients["bedrock"], shared_clients["dynamodb"], pool, prompts)
+
+    result = {
+        "client per invocation": lambda: client_per_invocation(endpoint, prompts),
+        "shared, default pool": shared_default_pool,
+        "aws_clients": shared_aws_clients,
+    }
+    try:
+        import aiobotocore  # noqa: F401
+        result["aws_clients async"] = lambda: aws_clients.run(gathered(endpoint, prompts))
+    except ImportError:
+        print("aiobotocore is not installed, skipping the async variant", file=sys.stderr)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--prompts", type=int, default=32, help="Bedrock calls per invocation")
+    parser.add_argument("--invocations", type=int, default=50)
+    parser.add_argument("--latency-ms", type=float, default=20, help="stub response time")
+    args = parser.parse_args()
+
+    os.environ.update(AWS_ACCESS_KEY_ID="benchmark", AWS_SECRET_ACCESS_KEY="benchmark", AWS_DEFAULT_REGION="us-east-1")
+    Stub.latency = args.latency_ms / 1000
+    server = ThreadingHTTPServer(("127.0.0.1", 0), Stub)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    endpoint = f"http://127.0.0.1:{server.server_address[1]}"
+
+    print(f"{args.prompts} Bedrock calls + 1 batch write per invocation, stub latency {args.latency_ms:.0f} ms")
+    print(f"{'handler':<24}{'first ms':>10}{'mean ms':>10}{'p50 ms':>10}{'p99 ms':>10}{'connections':>13}")
+    for name, handler in handlers(endpoint, args.prompts).items():
+        Stub.connections = 0
+        latencies = []
+        for _ in range(args.invocations + 1):
+            st = time.perf_counter()
+            handler()
+            latencies.append((time.perf_counter() - st) * 1000)
+        first, warm = latencies[0], sorted(latencies[1:])
+        print(f"{name:<24}{first:>10.1f}{statistics.mean(warm):>10.1f}{statistics.median(warm):>10.1f}"
+              f"{warm[min(len(warm) - 1, int(len(warm) * 0.99))]:>10.1f}{Stub.connections:>13}")
+    server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,118 @@
+"""
+Peak memory, time and log volume of decoding the text of a large SES email, comparing the previous
+get_decoded_content_text (whole message decoded and parsed, content printed) with the streaming decoder of
+mime_text.py the Lambda uses now:
+
+    python benchmark_mime_decode.py --attachment-mb 25
+
+The email is multipart/mixed: a multipart/alternative with a quoted-printable text/plain and a text/html part, and a
+binary attachment (or the other way around with --attachment-first), base64 encoded twice like SES publishes it. Memory is measured with tracemalloc, the encoded
+email itself is allocated before.
+"""
+import os
+import io
+import sys
+import time
+import quopri
+import base64
+import email
+import argparse
+import tracemalloc
+import contextlib
+from email.mime.application import MIMEApplication
+from email.mime.multipart import MIMEMultipart
+from email.mime.text import MIMEText
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "lambdas", "process_emails_with_bedrock"))
+from mime_text import decode_text_plain, iter_base64_lines
+
+TEXT = "Hello,\nplease ship 2 parcels of 300g from Seattle to Denver, délai 3 jours.\nThanks,\nJane\n"
+
+
+def previous_decode(message_content):
+    """get_decoded_content_text before the streaming decoder"""
+    content = base64.b64decode(message_content)
+    content_msg = email.message_from_string(content.decode("utf-8"))
+    content_msg_text = None
+
+    print("OUTPUT #2.1: content_msg:", content_msg)
+    if content_msg.get_content_type() == "multipart/mixed":
+        for payload in content_msg.get_payload():
+            if payload.get_content_type() == "multipart/alternative":
+                for sub_payload in payload.get_payload():
+                    if sub_payload.get_content_type() == "text/plain":
+                        content_msg_text = sub_payload.get_payload()
+                        break
+    elif content_msg.get_content_type() == "multipart/alternative":
+        for payload in content_msg.get_payload():
+            if payload.get_content_type() == "text/plain":
+                content_msg_text = payload.get_payload()
+                break
+
+    if content_msg_text:
+        try:
+            content_msg_text = base64.b64decode(content_msg_text).decode("utf-8")
+        except Exception:
+            pass
+        content_msg_text = content_msg_text.replace("\r\n", "\\r\\n").replace("\xa0", "\\xa0")
+        return quopri.decodestring(content_msg_text).decode("utf-8")
+    raise Exception("No text/plain part found in email")
+
+
+def streaming_decode(message_content):
+    return decode_text_plain(iter_base64_lines(message_content))
+
+
+def build_email(attachment_bytes, attachment_first):
+    alternative = MIMEMultipart("alternative")
+    alternative.attach(MIMEText(TEXT, "plain", "utf-8"))
+    alternative.attach(MIMEText(f"<html><body><p>{TEXT}</p></body></html>", "html", "utf-8"))
+    alternative.get_payload()[0].replace_header("Content-Transfer-Encoding", "quoted-printable")
+    alternative.get_payload()[0].set_payload(quopri.encodestring(TEXT.encode()).decode())
+    message = MIMEMultipart("mixed")
+    message["Subject"] = "Parcel shipment request"
+    parts = [alternative, MIMEApplication(os.urandom(attachment_bytes), Name="invoice.pdf")]
+    for part in reversed(parts) if attachment_first else parts:
+        message.attach(part)
+    return base64.b64encode(message.as_bytes()).decode()
+
+
+class CountingWriter(io.TextIOBase):
+    def __init__(self):
+        self.chars = 0
+
+    def write(self, s):
+        self.chars += len(s)
+        return len(s)
+
+
+def measure(fn, encoded):
+    log = CountingWriter()
+    tracemalloc.start()
+    st = time.perf_counter()
+    with contextlib.redirect_stdout(log):
+        text = fn(encoded)
+    seconds = time.perf_counter() - st
+    _, peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+    return text, seconds, peak, log.chars
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--attachment-mb", type=float, default=25)
+    parser.add_argument("--attachment-first", action="store_true",
+                        help="put the attachment before the text, the streaming decoder has to skip it")
+    args = parser.parse_args()
+
+    encoded = build_email(int(args.attachment_mb * 1024 * 1024), args.attachment_first)
+    print(f"attachment {args.attachment_mb} MB, SES content {len(encoded) / 1024 / 1024:.1f} MB base64")
+    print(f"{'decoder':<12}{'seconds':>10}{'peak MB':>10}{'logged MB':>12}")
+    for name, fn in {"previous": previous_decode, "streaming": streaming_decode}.items():
+        text, seconds, peak, logged = measure(fn, encoded)
+        assert "300g" in text, text
+        print(f"{name:<12}{seconds:>10.2f}{peak / 1024 / 1024:>10.1f}{logged / 1024 / 1024:>12.1f}")
+
+
+if __name__ == "__main__":
+    main()
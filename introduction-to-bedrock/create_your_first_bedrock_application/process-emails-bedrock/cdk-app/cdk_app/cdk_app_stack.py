@@ -1,3 +1,5 @@
+import math
+
 from aws_cdk import (
     Aws,
     CfnOutput,
@@ -6,8 +8,10 @@ from aws_cdk import (
     aws_dynamodb,
     aws_iam,
     aws_lambda,
+    aws_lambda_event_sources,
     aws_sns,
     aws_sns_subscriptions,
+    aws_sqs,
 )
 from constructs import Construct
 
@@ -16,6 +20,25 @@ class ProcessEmailBedrockStack(Stack):
     def __init__(self, scope: Construct, construct_id: str, **kwargs) -> None:
         super().__init__(scope, construct_id, **kwargs)
 
+        # how the emails are batched for the Lambda function, e.g. cdk deploy -c email_batch_size=50
+        batch_size = int(self.node.try_get_context("email_batch_size") or 10)
+        batching_window_seconds = int(self.node.try_get_context("email_batching_window_seconds") or 20)
+        max_concurrency = int(self.node.try_get_context("email_max_concurrency") or 10)
+        prompt_token_budget = int(self.node.try_get_context("email_prompt_token_budget") or 8000)
+        max_concurrent_prompts = int(self.node.try_get_context("email_max_concurrent_prompts") or 4)
+        # the timeout covers the worst case of a batch: every prompt generates its full output (500 tokens per email)
+        # and is not valid JSON, so each email is sent again alone. That is twice the tokens of the batch spread over
+        # the concurrent prompts, plus the longest prompt (4096 tokens) a worker may start last, at a conservative
+        # 25 tokens/s and 5s per Bedrock call for Claude v2, and 30s to decode and save the emails
+        seconds_per_email = 500 / 25 + 5
+        worst_case_seconds = 2 * batch_size * seconds_per_email / max_concurrent_prompts + 4096 / 25 + 5 + 30
+        if worst_case_seconds > 900:
+            raise ValueError(
+                f"a batch of {batch_size} emails may take {worst_case_seconds:.0f}s, over the 15 minutes of a Lambda "
+                "function: lower email_batch_size or raise email_max_concurrent_prompts"
+            )
+        function_timeout = Duration.seconds(math.ceil(worst_case_seconds))
+
         # create DynamoDB table
         table = aws_dynamodb.Table(
             self,
@@ -49,9 +72,11 @@ class ProcessEmailBedrockStack(Stack):
             runtime=aws_lambda.Runtime.PYTHON_3_12,
             handler="lambda.lambda_handler",
             code=aws_lambda.Code.from_asset("lambdas/process_emails_with_bedrock"),
-            timeout=Duration.seconds(60),
+            timeout=function_timeout,
             environment={
                 "TABLE_NAME": table.table_name,
+                "PROMPT_TOKEN_BUDGET": str(prompt_token_budget),
+                "MAX_CONCURRENT_PROMPTS": str(max_concurrent_prompts),
             },
         )
         # Add the layer to the function
@@ -76,8 +101,32 @@ class ProcessEmailBedrockStack(Stack):
             self,
             "ProcessEmailsWithBedrockTopic",
         )
+        # the topic feeds a queue the function consumes in batches, emails that fail are retried on their own
+        # and end up in the dead letter queue after 3 attempts
+        dead_letter_queue = aws_sqs.Queue(
+            self,
+            "ProcessEmailsWithBedrockDeadLetterQueue",
+            retention_period=Duration.days(14),
+        )
+        queue = aws_sqs.Queue(
+            self,
+            "ProcessEmailsWithBedrockQueue",
+            # at least 6 times the function timeout so that retries of the function do not make a batch visible again
+            visibility_timeout=Duration.seconds(6 * function_timeout.to_seconds()),
+            dead_letter_queue=aws_sqs.DeadLetterQueue(max_receive_count=3, queue=dead_letter_queue),
+        )
         sns_topic.add_subscription(
-            aws_sns_subscriptions.LambdaSubscription(lambda_function)
+            # raw message delivery: the message body is the SES notification, without the SNS envelope
+            aws_sns_subscriptions.SqsSubscription(queue, raw_message_delivery=True)
+        )
+        lambda_function.add_event_source(
+            aws_lambda_event_sources.SqsEventSource(
+                queue,
+                batch_size=batch_size,
+                max_batching_window=Duration.seconds(batching_window_seconds),
+                max_concurrency=max_concurrency,
+                report_batch_item_failures=True,
+            )
         )
 
         sns_topic.add_to_resource_policy(
@@ -98,6 +147,12 @@ class ProcessEmailBedrockStack(Stack):
             value=sns_topic.topic_name,
             description="The name of the SNS topic",
         )
+        CfnOutput(
+            self,
+            "ProcessEmailsWithBedrockDeadLetterQueueName",
+            value=dead_letter_queue.queue_name,
+            description="The name of the SQS queue of the emails that could not be processed",
+        )
         CfnOutput(
             self,
             "ProcessEmailBedrockTableName",
@@ -1,62 +1,58 @@
-import base64
-import email
+import concurrent.futures
 import json
 import os
-import quopri
+import time
 from decimal import Decimal
-import boto3
+from botocore.exceptions import BotoCoreError, ClientError
+import aws_clients
+from mime_text import decode_text_plain, iter_base64_lines
+from prompt_packer import estimate_tokens, truncate_to_tokens
+from prompt_template import PromptTemplate
 
-# get the bedrock client to invoke the foundation models
-bedrock_client = boto3.client("bedrock-runtime")
 # read the environment variable containing the dynamoDB table name
 TABLE_NAME = os.getenv("TABLE_NAME")
-# get the dynamoDB table name resource to populate with extracted information
-table = boto3.resource("dynamodb").Table(TABLE_NAME)
+# tokens of emails in one prompt, the emails of a batch are split into as many prompts as needed to stay under it
+PROMPT_TOKEN_BUDGET = int(os.getenv("PROMPT_TOKEN_BUDGET", "8000"))
+# tokens the model may generate for the fields extracted from one email
+OUTPUT_TOKENS_PER_EMAIL = int(os.getenv("OUTPUT_TOKENS_PER_EMAIL", "500"))
+# Claude v2 generates at most 4096 tokens, which bounds the emails per prompt whatever their size
+MAX_EMAILS_PER_PROMPT = max(1, 4096 // OUTPUT_TOKENS_PER_EMAIL)
+# prompts of one batch sent to Bedrock at the same time
+MAX_CONCURRENT_PROMPTS = int(os.getenv("MAX_CONCURRENT_PROMPTS", "4"))
+# log the decoded emails, prompts and model responses in full, only for debugging: it puts the emails in the logs
+DEBUG_PRINTS = os.getenv("DEBUG_PRINTS", "false").lower() == "true"
+
+# get the bedrock client to invoke the foundation models, with a connection per concurrent prompt,
+# adaptive retries slow the prompts of the container down when Bedrock throttles
+bedrock_client = aws_clients.client("bedrock-runtime", max_concurrency=MAX_CONCURRENT_PROMPTS, retry_mode="adaptive")
+# the dynamoDB resource to batch write the extracted information to the table
+dynamodb = aws_clients.resource("dynamodb")
+# parse the prompt template once per cold start, {emails} is replaced by the emails to process
+prompt_template = PromptTemplate.from_file("prompt.txt", ["emails"])
+
+
+def debug(*args):
+    """
+    Print only with DEBUG_PRINTS
+    """
+    if DEBUG_PRINTS:
+        print(*args)
 
 
 def get_decoded_content_text(message_content):
     """
-    Decode the email message
+    Decode the email message, streaming: attachments are skipped without being decoded or kept in memory
+    see https://docs.aws.amazon.com/ses/latest/dg/send-email-raw.html for info on content types and parts
     Args:
         message_content: encoded message
     Returns:
-        decoded message
-    """
-    content = base64.b64decode(message_content)
-    content_msg = email.message_from_string(content.decode("utf-8"))
-    content_msg_text = None
-
-    print("OUTPUT #2.1: content_msg:", content_msg)
-    # see https://docs.aws.amazon.com/ses/latest/dg/send-email-raw.html
-    # for info on content types and parts
-    if content_msg.get_content_type() == "multipart/mixed":
-        # multipart/mixed has two parts: multipart/alternative and the attachment
-        for payload in content_msg.get_payload():
-            if payload.get_content_type() == "multipart/alternative":
-                for sub_payload in payload.get_payload():
-                    if sub_payload.get_content_type() == "text/plain":
-                        content_msg_text = sub_payload.get_payload()
-                        break
-    elif content_msg.get_content_type() == "multipart/alternative":
-        # multipart/alternative has two parts: text/plain and text/html
-        for payload in content_msg.get_payload():
-            if payload.get_content_type() == "text/plain":
-                content_msg_text = payload.get_payload()
-                break
-
-    if content_msg_text:
-        # may need to base64 decode again
-        try:
-            content_msg_text = base64.b64decode(content_msg_text).decode("utf-8")
-        except Exception:
-            pass
-        content_msg_text = content_msg_text.replace("\r\n", "\\r\\n").replace(
-            "\xa0", "\\xa0"
-        )
-        return quopri.decodestring(content_msg_text).decode("utf-8")
-    else:
-        # raise Exception("No text/plain part found in email:\n" + content_msg.as_string())
+        decoded text/plain part of the message
+    """
+    content_msg_text = decode_text_plain(iter_base64_lines(message_content))
+    if content_msg_text is None:
         raise Exception("No text/plain part found in email")
+    debug("OUTPUT #2.1: content_msg_text:", content_msg_text)
+    return content_msg_text
 
 
 def parse_float(value):
@@ -69,39 +65,70 @@ def parse_float(value):
         return value
 
 
+def email_tag(mail):
+    """
+    Build the xml tag of one email for the prompt
+    Args:
+        mail (dict): the SES mail object, with the decoded text in "decoded_message"
+    Returns:
+        the <email> tag
+    """
+    thread_index = None
+    for header in mail["headers"]:
+        if header["name"] == "Thread-Index":
+            thread_index = header["value"]
+    # the emails are not from one thread, a quote may be all the information there is: at most a prompt of the text
+    message = truncate_to_tokens(str(mail["decoded_message"]), PROMPT_TOKEN_BUDGET)
+    return "".join([
+        "<email>",
+        "<messageId>", str(mail["messageId"]), "</messageId>",
+        "<Timestamp>", str(mail["timestamp"]), "</Timestamp>",
+        "<ThreadIndex>", str(thread_index), "</ThreadIndex>",
+        "<subject>", str(mail["commonHeaders"]["subject"]), "</subject>",
+        "<message>", message, "</message>",
+        "</email>",
+    ])
+
+
+def chunk_emails(emails, token_budget=PROMPT_TOKEN_BUDGET, max_emails=MAX_EMAILS_PER_PROMPT):
+    """
+    Split the emails into prompts of at most token_budget tokens of emails and max_emails emails, in order.
+    An email over the budget on its own gets a prompt of its own.
+    Args:
+        emails (list): (mail, email tag) pairs
+    Returns:
+        list of lists of (mail, email tag) pairs
+    """
+    chunks, chunk, tokens = [], [], 0
+    for mail, tag in emails:
+        tag_tokens = estimate_tokens(tag)
+        if chunk and (tokens + tag_tokens > token_budget or len(chunk) == max_emails):
+            chunks.append(chunk)
+            chunk, tokens = [], 0
+        chunk.append((mail, tag))
+        tokens += tag_tokens
+    if chunk:
+        chunks.append(chunk)
+    return chunks
+
+
 def process_emails_with_bedrock(emails):
     """
     Process the emails with a Bedrock foundation model
     Args:
-        emails (list): list of emails to process
+        emails (list): list of email tags to process in one prompt
     Returns:
-        Bedrock message
-    """
-    # read the prompt template
-    prompt = open("prompt.txt", "r").read()
-
-    # Prompt engineering: extract the necessary information from the emails to create the optimal prompt
-    emails_str = "<emails>"
-    for e in emails:
-        thread_index = None
-        for header in e["headers"]:
-            if header["name"] == "Thread-Index":
-                thread_index = header["value"]
-        emails_str += "<email>"
-        emails_str += "<messageId>" + str(e["messageId"]) + "</messageId>"
-        emails_str += "<Timestamp>" + str(e["timestamp"]) + "</Timestamp>"
-        emails_str += "<ThreadIndex>" + str(thread_index) + "</ThreadIndex>"
-        emails_str += "<subject>" + str(e["commonHeaders"]["subject"]) + "</subject>"
-        emails_str += "<message>" + str(e["decoded_message"]) + "</message>"
-        emails_str += "</email>"
-    emails_str += "</emails>"
-    prompt = prompt.replace("<emails></emails>", emails_str)
-    print("OUTPUT #4: prompt:", prompt)
+        Bedrock message, a JSON list with the information of every email
+    """
+    # the <emails> tags around them are part of the template
+    prompt = prompt_template.render({"emails": "".join(emails)})
+    print("OUTPUT #4: prompt of", len(emails), "emails,", estimate_tokens(prompt), "tokens")
+    debug("OUTPUT #4.1: prompt:", prompt)
 
     # prepare the parameter to invoke the Antropic Claude on Bedrock
     body = {
         "prompt": prompt,
-        "max_tokens_to_sample": 500,
+        "max_tokens_to_sample": OUTPUT_TOKENS_PER_EMAIL * len(emails),
         "temperature": 0,
         "top_k": 250,
         "top_p": 0.999,
@@ -118,30 +145,145 @@ def process_emails_with_bedrock(emails):
     return json.loads(response.get("body").read()).get("completion")
 
 
+class UnparsableResponse(Exception):
+    """
+    The model response to a prompt of several emails is not valid JSON
+    """
+
+
+def extract_chunk(chunk):
+    """
+    Extract the information of the emails of one prompt
+    Args:
+        chunk (list): (mail, email tag) pairs
+    Returns:
+        dict of messageId to the item to save, emails missing from the model response are left out
+    Raises:
+        UnparsableResponse: the response to several emails is not valid JSON, they are to be sent again one per prompt
+    """
+    bedrock_response = process_emails_with_bedrock([tag for _, tag in chunk])
+    debug("OUTPUT #5: Bedrock response", bedrock_response)
+    try:
+        parsed_emails = json.loads(bedrock_response, parse_float=parse_float)
+    except ValueError as error:
+        if len(chunk) == 1:
+            raise
+        raise UnparsableResponse(repr(error)) from error
+    if isinstance(parsed_emails, dict):
+        parsed_emails = [parsed_emails]
+    mails = {mail["messageId"]: mail for mail, _ in chunk}
+    items = {}
+    for parsed_email in parsed_emails:
+        mail = mails.get(parsed_email.get("MessageId"))
+        if mail is None:
+            continue
+        # the table keys come from the email, not from the model
+        parsed_email["MessageId"] = mail["messageId"]
+        parsed_email["Timestamp"] = str(mail["timestamp"])
+        # the model is not asked to echo the email back, the text is saved as decoded
+        parsed_email["Message"] = mail["decoded_message"]
+        items[mail["messageId"]] = parsed_email
+    return items
+
+
+def save_items(items, max_attempts=8):
+    """
+    Save the items 25 at a time with batch_write_item, retrying the unprocessed ones with exponential backoff
+    Args:
+        items (dict): messageId to item
+    Returns:
+        the messageIds of the items that could not be written after max_attempts or whose batch write raised
+    """
+    failed = []
+    items = list(items.items())
+    for start in range(0, len(items), 25):
+        batch = dict(items[start:start + 25])
+        requests = [{"PutRequest": {"Item": item}} for item in batch.values()]
+        try:
+            for attempt in range(max_attempts):
+                response = dynamodb.batch_write_item(RequestItems={TABLE_NAME: requests})
+                requests = response.get("UnprocessedItems", {}).get(TABLE_NAME, [])
+                if not requests:
+                    break
+                time.sleep(min(0.05 * 2 ** attempt, 5))
+        except (BotoCoreError, ClientError) as error:
+            # e.g. a validation error, an item over the 400 KB limit or throttling past the client retries:
+            # the whole batch is not saved
+            print("Failed to save", list(batch), repr(error))
+            failed += list(batch)
+            continue
+        failed += [request["PutRequest"]["Item"]["MessageId"] for request in requests]
+    return failed
+
+
+def process_messages(messages):
+    """
+    Extract the information of the emails of a batch and save it to dynamoDB.
+    The emails are packed into prompts by token budget, the prompts are sent MAX_CONCURRENT_PROMPTS at a time and
+    the items of each prompt are saved as it completes. The emails of a prompt whose response is not valid JSON are
+    sent again one per prompt on the same pool. An email that fails (decoding, model call, missing from the
+    response, write) does not fail the others.
+    Args:
+        messages (list): (record id, SES notification) pairs
+    Returns:
+        (saved items, ids of the records that failed)
+    """
+    failed, emails, record_ids = [], [], {}
+    # process the emails of the batch
+    for record_id, message in messages:
+        try:
+            mail = message["mail"]
+            mail.update({"decoded_message": get_decoded_content_text(message["content"])})
+            emails.append((mail, email_tag(mail)))
+            record_ids[mail["messageId"]] = record_id
+        except Exception as error:
+            print("Failed to decode record", record_id, repr(error))
+            failed.append(record_id)
+
+    chunks = chunk_emails(emails)
+    print("OUTPUT #3:", len(emails), "emails in", len(chunks), "prompts")
+    items, not_saved = {}, set()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=MAX_CONCURRENT_PROMPTS) as pool:
+        futures = {pool.submit(extract_chunk, chunk): chunk for chunk in chunks}
+        while futures:
+            done, _ = concurrent.futures.wait(futures, return_when=concurrent.futures.FIRST_COMPLETED)
+            for future in done:
+                chunk = futures.pop(future)
+                try:
+                    chunk_items = future.result()
+                except UnparsableResponse as error:
+                    # one malformed email spoils the whole list, give each email a prompt of its own
+                    print("Unparsable response for", len(chunk), "emails, extracting them one at a time", error)
+                    futures.update({pool.submit(extract_chunk, [pair]): [pair] for pair in chunk})
+                    continue
+                except Exception as error:
+                    print("Failed to extract", [mail["messageId"] for mail, _ in chunk], repr(error))
+                    continue
+                # Save the email information to dynamoDB now: a timeout later in the batch does not lose it
+                not_saved.update(save_items(chunk_items))
+                items.update(chunk_items)
+
+    for message_id, record_id in record_ids.items():
+        if message_id not in items or message_id in not_saved:
+            failed.append(record_id)
+    return [item for message_id, item in items.items() if message_id not in not_saved], failed
+
+
 def lambda_handler(event, context):
-    print("OUTPUT #1: event:", event)
+    print("OUTPUT #1:", len(event["Records"]), "records")
+    # SQS batches from the queue subscribed to the SNS topic (raw message delivery, the body is the SES notification)
+    # and, for direct subscriptions, SNS records
     messages = [
-        json.loads(record["Sns"]["Message"])
+        (record["messageId"], json.loads(record["body"])) if record.get("eventSource") == "aws:sqs"
+        else (record["Sns"]["MessageId"], json.loads(record["Sns"]["Message"]))
         for record in event["Records"]
-        if record["EventSource"] == "aws:sns"
+        if record.get("eventSource") == "aws:sqs" or record.get("EventSource") == "aws:sns"
     ]
-    emails = []
-    # process the emails from SNS
-    for message in messages:
-        print("OUTPUT #2: message:", message)
-        decoded_message = get_decoded_content_text(message["content"])
-        mail = message["mail"]
-        mail.update({"decoded_message": decoded_message})
-        emails.append(mail)
-
-    print("OUTPUT #3: emails:", emails)
-
-    bedrock_response = process_emails_with_bedrock(emails)
-    print("OUTPUT #5: Bedrock response", bedrock_response)
-
-    # Save the email information to dynamoDB
-    parsed_email = json.loads(bedrock_response, parse_float=parse_float)
-    print("OUTPUT #6: Parsed email", parsed_email)
-    table.put_item(Item=parsed_email)
-
-    return {"body": parsed_email}
+    items, failed = process_messages(messages)
+    print("OUTPUT #6:", len(items), "emails saved,", len(failed), "failed")
+
+    if failed and any(record.get("EventSource") == "aws:sns" for record in event["Records"]):
+        # SNS can not retry part of an event
+        raise Exception(f"{len(failed)} emails failed: {failed}")
+    # with ReportBatchItemFailures only the failed records go back to the queue
+    return {"batchItemFailures": [{"itemIdentifier": record_id} for record_id in failed]}
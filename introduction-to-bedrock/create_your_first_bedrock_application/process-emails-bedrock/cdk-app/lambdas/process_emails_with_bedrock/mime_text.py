@@ -0,0 +1,128 @@
+"""
+Streaming decode of the text of a raw email, as SES publishes it base64 encoded: the message is base64 decoded a
+chunk at a time and scanned line by line. Only the headers of each part (parsed with email.parser.BytesParser) and
+the body of the first text/plain part are kept, attachment bodies are skipped as they go by, so memory does not grow
+with the size of the attachments.
+"""
+import base64
+import io
+import quopri
+from email.parser import BytesParser
+
+# characters of base64 decoded at a time
+CHUNK_SIZE = 1 << 16
+
+header_parser = BytesParser()
+
+
+def iter_base64_lines(encoded, chunk_size=CHUNK_SIZE):
+    """
+    Yield the lines, with their line endings, of base64 encoded content, decoded chunk_size characters at a time
+    """
+    pending, rest = "", b""
+    for start in range(0, len(encoded), chunk_size):
+        # whitespace is not part of the encoding, and base64 decodes by groups of 4 characters
+        pending += "".join(encoded[start:start + chunk_size].split())
+        end = len(pending) // 4 * 4
+        data = rest + base64.b64decode(pending[:end])
+        pending = pending[end:]
+        end = data.rfind(b"\n") + 1
+        yield from io.BytesIO(data[:end])
+        rest = data[end:]
+    if pending:
+        rest += base64.b64decode(pending + "=" * (-len(pending) % 4))
+    if rest:
+        yield rest
+
+
+def read_headers(lines):
+    """
+    Parse the header block of a part, up to the empty line, None at the end of the message
+    """
+    block = []
+    for line in lines:
+        if not line.strip():
+            # a part without headers is text/plain
+            return header_parser.parsebytes(b"".join(block), headersonly=True)
+        block.append(line)
+    return header_parser.parsebytes(b"".join(block), headersonly=True) if block else None
+
+
+def read_part_body(lines, boundaries, body=None):
+    """
+    Read the body of a part up to the boundary of the next part, appending its lines to body unless it is None.
+    A closing boundary ends its multipart and those nested in it, the rest of the enclosing one is skipped.
+    Returns:
+        True when more parts may follow, False at the end of the message
+    """
+    for line in lines:
+        if line.startswith(b"--"):
+            marker = line.rstrip()
+            for i in range(len(boundaries) - 1, -1, -1):
+                if marker == boundaries[i]:
+                    del boundaries[i + 1:]
+                    return True
+                if marker == boundaries[i] + b"--":
+                    del boundaries[i:]
+                    if body is not None:
+                        # the body is complete, what follows is not needed
+                        return bool(boundaries)
+                    break
+            else:
+                if body is not None:
+                    body.append(line)
+            continue
+        if body is not None:
+            body.append(line)
+    return False
+
+
+def decode_body(body, headers):
+    """
+    Decode the body of a part with its Content-Transfer-Encoding and charset
+    """
+    # the line break before a boundary belongs to the boundary
+    if body.endswith(b"\r\n"):
+        body = body[:-2]
+    elif body.endswith(b"\n"):
+        body = body[:-1]
+    encoding = headers.get("Content-Transfer-Encoding", "").strip().lower()
+    if encoding == "base64":
+        body = base64.b64decode(body)
+    elif encoding == "quoted-printable":
+        body = quopri.decodestring(body)
+    charset = headers.get_content_charset() or "utf-8"
+    try:
+        text = body.decode(charset, errors="replace")
+    except LookupError:
+        text = body.decode("utf-8", errors="replace")
+    return text.replace("\r\n", "\n")
+
+
+def decode_text_plain(lines):
+    """
+    Find and decode the first text/plain part of a raw email that is not an attachment
+    Args:
+        lines: iterable of the lines of the raw email, in bytes
+    Returns:
+        the text, None if the email has no text/plain part
+    """
+    lines = iter(lines)
+    # boundary markers of the enclosing multiparts, innermost last
+    boundaries = []
+    while True:
+        headers = read_headers(lines)
+        if headers is None:
+            return None
+        if headers.get_content_maintype() == "multipart" and headers.get_boundary():
+            boundaries.append(b"--" + headers.get_boundary().encode())
+            # skip the preamble
+            if not read_part_body(lines, boundaries):
+                return None
+            continue
+        if headers.get_content_type() == "text/plain" and headers.get_content_disposition() != "attachment":
+            body = []
+            read_part_body(lines, boundaries, body)
+            return decode_body(b"".join(body), headers)
+        if not read_part_body(lines, boundaries):
+            return None
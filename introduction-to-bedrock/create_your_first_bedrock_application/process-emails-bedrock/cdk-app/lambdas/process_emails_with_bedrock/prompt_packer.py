@@ -0,0 +1,173 @@
+"""
+Packs the emails of a thread into a prompt under a token budget, without knowing the model's tokenizer:
+- tokens are estimated offline from characters and words, on the high side for English text
+- quoted reply chains are removed, each email keeps only what it adds to the emails kept in full before it
+- forwarded emails are kept unless their text is in an earlier email kept in full
+- the newest emails are kept in full, older ones are shortened to their first words and the oldest are left out
+  when even that does not fit
+
+Everything is built with lists joined once, a pass is linear in the size of the thread. The thread is packed again
+when an email that other emails were deduplicated against does not end up in full, usually once or twice.
+"""
+import re
+
+# where a reply starts quoting the previous email: "On Mon, Jan 1, 2024 at 10:00 Jane <jane@example.com> wrote:"
+# (possibly wrapped on two lines) or Outlook's "-----Original Message-----"
+QUOTE_HEADER = re.compile(
+    r"^(On [^\n]{0,200}(\n[^\n]{0,200})? wrote:[ \t]*$"
+    r"|-{2,}[ \t]*Original Message[ \t]*-{2,})",
+    re.M | re.I,
+)
+# where an email includes another one: "---------- Forwarded message ---------" or a "From: ... Sent: ..." block,
+# which is often the only content of a forward and not a quote of the thread
+FORWARD_HEADER = re.compile(r"^(-{2,}[ \t]*Forwarded message[ \t]*-{2,}|From:[^\n]*\n(Sent|Date):)", re.M | re.I)
+# lines at least this long seen in an earlier email of the thread are quotes, shorter ones ("Thanks,") are not
+MIN_REPEATED_LINE = 40
+
+
+def estimate_tokens(text):
+    """
+    Estimate the tokens of a text: about 4 characters or 3/4 of a word per token for English,
+    whichever gives more (long words, numbers and punctuation make more tokens per word)
+    """
+    return max(len(text) // 4, len(text.split()) * 4 // 3) + 1
+
+
+def truncate_to_tokens(text, max_tokens, marker=" [...]"):
+    """
+    Shorten a text to its first words so that it has about max_tokens tokens, marker is added when it was shortened
+    """
+    if estimate_tokens(text) <= max_tokens:
+        return text
+    # 3 words and 12 characters per 4 tokens, the lower of the two bounds estimate_tokens uses
+    words = text[:max_tokens * 4].split()[:max_tokens * 3 // 4]
+    return " ".join(words) + marker
+
+
+def strip_quoted(body):
+    """
+    Remove the quoted reply chain of an email: everything from the first quote header and the lines starting with ">"
+    """
+    match = QUOTE_HEADER.search(body)
+    if match:
+        body = body[:match.start()]
+    return "\n".join(line for line in body.rstrip().split("\n") if not line.lstrip().startswith(">"))
+
+
+def line_key(line):
+    return " ".join(line.split())
+
+
+def dedupe_thread(bodies, kept=None):
+    """
+    Remove from each body the quoted reply chain, the forwarded emails whose long lines are all in an earlier kept
+    body, and the long lines already in an earlier kept body, the quotes of mail clients that do not mark them
+    Args:
+        bodies (list): the email bodies, oldest first
+        kept (list): whether each body ends up in the prompt as it is, the others are not deduplicated against;
+            all of them by default
+    Returns:
+        list of the deduplicated bodies
+    """
+    seen, result = set(), []
+    for i, body in enumerate(bodies):
+        body = strip_quoted(body)
+        match = FORWARD_HEADER.search(body)
+        if match:
+            forwarded = [key for key in map(line_key, body[match.end():].split("\n")) if len(key) >= MIN_REPEATED_LINE]
+            if forwarded and all(key in seen for key in forwarded):
+                body = body[:match.start()]
+        keys, lines = set(), []
+        for line in body.split("\n"):
+            key = line_key(line)
+            if len(key) >= MIN_REPEATED_LINE:
+                if key in seen or key in keys:
+                    continue
+                keys.add(key)
+            lines.append(line)
+        if kept is None or kept[i]:
+            seen |= keys
+        result.append("\n".join(lines).strip())
+    return result
+
+
+class PackedThread:
+    def __init__(self, text, tokens, full, summarized, omitted):
+        self.text = text
+        self.tokens = tokens
+        self.full = full
+        self.summarized = summarized
+        self.omitted = omitted
+
+    def __str__(self):
+        return (f"{self.tokens} tokens: {self.full} emails in full, {self.summarized} shortened, "
+                f"{self.omitted} omitted")
+
+
+def pack_thread(emails, render_email, token_budget, body_key="message", summary_tokens=60, full_share=0.75,
+                omitted_note="<omitted>{} earlier emails</omitted>\n"):
+    """
+    Pack the emails of a thread into at most token_budget estimated tokens
+    Args:
+        emails (list): the emails as dicts, oldest first
+        render_email (function): render_email(email, body) returns the prompt text of an email with the given body
+        token_budget (int): estimated tokens of the packed emails
+        body_key (str): the key of the email body in the emails
+        summary_tokens (int): tokens of the body of a shortened email
+        full_share (float): share of the budget of the emails in full when the thread does not fit
+        omitted_note (str): added in place of the oldest emails when they are left out, {} is their number
+    Returns:
+        PackedThread with the text of the emails, oldest first
+    """
+    raw_bodies = [email[body_key] for email in emails]
+    # bodies are only deduplicated against emails that end up in full, the shortened and omitted ones do not show the
+    # lines removed from the others: pack again without them until they are all in full. Every pass leaves out at
+    # least one more email, so this ends after at most one pass per email
+    kept = [True] * len(emails)
+    while True:
+        packed = pack_bodies(emails, dedupe_thread(raw_bodies, kept), render_email, token_budget, summary_tokens,
+                             full_share, omitted_note)
+        full = [i >= len(emails) - packed.full for i in range(len(emails))]
+        if all(f or not k for f, k in zip(full, kept)):
+            return packed
+        kept = [f and k for f, k in zip(full, kept)]
+
+
+def pack_bodies(emails, bodies, render_email, token_budget, summary_tokens, full_share, omitted_note):
+    """
+    Pack the emails with the given bodies, see pack_thread
+    """
+    parts, part_tokens, tokens = [], [], 0
+    # the newest emails matter most: walk the thread backwards, in full while it fits, then shortened
+    i = len(emails) - 1
+    while i >= 0:
+        text = render_email(emails[i], bodies[i])
+        text_tokens = estimate_tokens(text)
+        if tokens + text_tokens > token_budget:
+            break
+        parts.append(text)
+        part_tokens.append(text_tokens)
+        tokens += text_tokens
+        i -= 1
+    if i >= 0:
+        # the thread does not fit, leave part of the budget to the shortened older emails
+        while parts and tokens > token_budget * full_share:
+            parts.pop()
+            tokens -= part_tokens.pop()
+            i += 1
+    full = len(parts)
+    note_tokens = estimate_tokens(omitted_note)
+    while i >= 0:
+        text = render_email(emails[i], truncate_to_tokens(bodies[i], summary_tokens))
+        text_tokens = estimate_tokens(text)
+        if tokens + text_tokens + (note_tokens if i else 0) > token_budget:
+            break
+        parts.append(text)
+        tokens += text_tokens
+        i -= 1
+    summarized = len(parts) - full
+    if i >= 0:
+        parts.append(omitted_note.format(i + 1))
+        tokens += note_tokens
+    parts.reverse()
+    return PackedThread("".join(parts), tokens, full, summarized, i + 1)
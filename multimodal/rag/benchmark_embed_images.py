@@ -0,0 +1,164 @@
+"""
+Benchmark the serial embedding loop from 1_multimodal_rag.ipynb against embed_images.embed_image_dataset.
+
+Both run against a local mock of the Bedrock runtime invoke_model endpoint that adds a fixed latency per call
+and throttles when more than --mock-capacity requests are in flight, so no AWS account is needed:
+
+    python benchmark_embed_images.py --count 1000 --latency 0.2 --mock-capacity 24 --max-concurrency 32
+"""
+import os
+import json
+import time
+import base64
+import logging
+import argparse
+import tempfile
+import threading
+import faiss
+import numpy as np
+import pandas as pd
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from embed_images import create_bedrock_client, embed_row, embed_image_dataset, ThrottledError
+
+logging.basicConfig(format='[%(asctime)s] p%(process)s {%(filename)s:%(lineno)d} %(levelname)s - %(message)s', level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+MODEL_ID: str = "amazon.titan-embed-image-v1"
+EMBEDDING_DIM: int = 1024
+
+
+class MockBedrockRuntime(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, latency: float, capacity: int):
+        super().__init__(address, MockInvokeModelHandler)
+        self.latency = latency
+        self.capacity = capacity
+        self.in_flight = 0
+        self.calls = 0
+        self.throttled = 0
+        self.lock = threading.Lock()
+
+
+class MockInvokeModelHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def _send(self, status: int, body: dict, headers: dict = {}):
+        payload = json.dumps(body).encode("utf-8")
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(payload)))
+        for k, v in headers.items():
+            self.send_header(k, v)
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def do_POST(self):
+        request = json.loads(self.rfile.read(int(self.headers["Content-Length"])))
+        server = self.server
+        with server.lock:
+            server.calls += 1
+            throttle = server.in_flight >= server.capacity
+            if throttle:
+                server.throttled += 1
+            else:
+                server.in_flight += 1
+        if throttle:
+            self._send(429, {"message": "Too many requests, please wait before trying again."},
+                       {"x-amzn-ErrorType": "ThrottlingException"})
+            return
+        try:
+            time.sleep(server.latency)
+            # deterministic vector per input so both runs produce the same index
+            seed = hash(request.get("inputText", "")) & 0xFFFFFFFF
+            embedding = np.random.default_rng(seed).random(EMBEDDING_DIM).tolist()
+            self._send(200, {"embedding": embedding, "inputTextTokenCount": 8})
+        finally:
+            with server.lock:
+                server.in_flight -= 1
+
+
+def make_dataset(count: int, data_dir: str) -> pd.DataFrame:
+    image = base64.b64encode(os.urandom(64 * 1024))
+    rows = []
+    for i in range(count):
+        path_b64 = os.path.join(data_dir, f"{i}.jpg.b64")
+        with open(path_b64, "wb") as f:
+            f.write(image)
+        rows.append({"path": f"{i}.jpg", "path_b64": path_b64, "description": f"product {i}"})
+    return pd.DataFrame(rows)
+
+
+def run_serial(bedrock, image_dataset: pd.DataFrame) -> int:
+    # the loop from 1_multimodal_rag.ipynb, one invoke_model and one faiss add per row
+    index = None
+    for _, row in image_dataset.iterrows():
+        while True:
+            try:
+                embeddings = embed_row(bedrock, MODEL_ID, row)
+                break
+            except ThrottledError:
+                time.sleep(0.1)
+        if index is None:
+            index = faiss.IndexFlatIP(embeddings.shape[1])
+        faiss.normalize_L2(embeddings)
+        index.add(embeddings)
+    return index.ntotal
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--count", type=int, default=500)
+    parser.add_argument("--latency", type=float, default=0.2, help="mock invoke_model latency in seconds")
+    parser.add_argument("--mock-capacity", type=int, default=24, help="in-flight requests before the mock throttles")
+    parser.add_argument("--max-concurrency", type=int, default=32)
+    parser.add_argument("--batch-size", type=int, default=256)
+    parser.add_argument("--skip-serial", action="store_true")
+    args = parser.parse_args()
+
+    # botocore signs every request, the mock does not care about the credentials
+    os.environ.setdefault("AWS_ACCESS_KEY_ID", "mock")
+    os.environ.setdefault("AWS_SECRET_ACCESS_KEY", "mock")
+
+    server = MockBedrockRuntime(("127.0.0.1", 0), args.latency, args.mock_capacity)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    endpoint_url = f"http://127.0.0.1:{server.server_address[1]}"
+    logger.info(f"mock bedrock runtime listening on {endpoint_url}")
+
+    with tempfile.TemporaryDirectory() as tmp:
+        image_dataset = make_dataset(args.count, tmp)
+        bedrock = create_bedrock_client(endpoint_url, "us-east-1", args.max_concurrency)
+        results = {}
+
+        if not args.skip_serial:
+            st = time.perf_counter()
+            n = run_serial(bedrock, image_dataset)
+            results["serial"] = (n, time.perf_counter() - st)
+
+        index_fpath = os.path.join(tmp, "index")
+        data_fpath = os.path.join(tmp, "data.csv")
+        server.throttled = 0
+        st = time.perf_counter()
+        index, _ = embed_image_dataset(image_dataset, index_fpath, data_fpath, MODEL_ID, bedrock=bedrock,
+                                       max_concurrency=args.max_concurrency, batch_size=args.batch_size)
+        results["pipeline"] = (index.ntotal, time.perf_counter() - st)
+        pipeline_throttled = server.throttled
+
+        # a second run must be a no-op thanks to the checkpoint
+        st = time.perf_counter()
+        index, _ = embed_image_dataset(image_dataset, index_fpath, data_fpath, MODEL_ID, bedrock=bedrock,
+                                       max_concurrency=args.max_concurrency, batch_size=args.batch_size)
+        results["resume"] = (index.ntotal, time.perf_counter() - st)
+
+    print(f"\n{'run':<10}{'embedded':>10}{'seconds':>10}{'images/s':>10}")
+    for name, (n, elapsed) in results.items():
+        print(f"{name:<10}{n:>10}{elapsed:>10.2f}{n / elapsed:>10.1f}")
+    print(f"pipeline runs were throttled {pipeline_throttled} times by the mock")
+    server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,192 @@
+import os
+import json
+import time
+import random
+import boto3
+import faiss
+import asyncio
+import logging
+import numpy as np
+import pandas as pd
+from concurrent.futures import ThreadPoolExecutor
+from typing import List, Optional, Tuple
+from botocore.config import Config
+from botocore.exceptions import ClientError
+
+logger = logging.getLogger(__name__)
+
+# bedrock error codes that mean "slow down" rather than "this request is bad"
+THROTTLING_ERROR_CODES = ("ThrottlingException", "TooManyRequestsException", "ServiceUnavailableException")
+
+
+class ThrottledError(Exception):
+    pass
+
+
+def create_bedrock_client(endpoint_url: Optional[str], region_name: str, max_concurrency: int):
+    # size the connection pool to the concurrency and leave retries to the pipeline
+    # so that throttling is visible to the adaptive limiter instead of being absorbed by botocore
+    config = Config(max_pool_connections=max_concurrency, retries={"max_attempts": 1, "mode": "standard"})
+    return boto3.client(service_name="bedrock-runtime", region_name=region_name, endpoint_url=endpoint_url, config=config)
+
+
+def get_embeddings(bedrock, model_id: str, text: str, image: str) -> np.ndarray:
+    body = json.dumps({"inputText": text, "inputImage": image})
+    try:
+        response = bedrock.invoke_model(body=body, modelId=model_id, accept="application/json", contentType="application/json")
+    except ClientError as e:
+        if e.response["Error"]["Code"] in THROTTLING_ERROR_CODES:
+            raise ThrottledError(e.response["Error"]["Code"]) from e
+        raise
+    response_body = json.loads(response.get("body").read())
+    return np.array([response_body.get("embedding")]).astype(np.float32)
+
+
+def embed_row(bedrock, model_id: str, row: pd.Series) -> np.ndarray:
+    # MAX image size supported is 2048 * 2048 pixels, the files are already scaled in 0_data_prep.ipynb
+    with open(row["path_b64"], "rb") as image_file:
+        input_image_b64 = image_file.read().decode("utf-8")
+    input_text = "No description" if pd.isna(row["description"]) else row["description"]
+    return get_embeddings(bedrock, model_id, input_text, input_image_b64)
+
+
+class AdaptiveLimiter:
+    """Concurrency limit that halves on throttling and grows by one after a run of successes (AIMD)."""
+
+    def __init__(self, max_concurrency: int, min_concurrency: int = 1, increase_after: int = 20):
+        self.max_concurrency = max_concurrency
+        self.min_concurrency = min_concurrency
+        self.increase_after = increase_after
+        self.limit = max_concurrency
+        self.in_flight = 0
+        self.successes = 0
+        self.throttles = 0
+        self._cond = asyncio.Condition()
+
+    async def __aenter__(self):
+        async with self._cond:
+            await self._cond.wait_for(lambda: self.in_flight < self.limit)
+            self.in_flight += 1
+        return self
+
+    async def __aexit__(self, exc_type, exc, tb):
+        async with self._cond:
+            self.in_flight -= 1
+            self._cond.notify_all()
+
+    async def on_success(self):
+        async with self._cond:
+            self.successes += 1
+            if self.successes >= self.increase_after and self.limit < self.max_concurrency:
+                self.limit += 1
+                self.successes = 0
+                self._cond.notify_all()
+
+    async def on_throttle(self):
+        async with self._cond:
+            self.throttles += 1
+            self.successes = 0
+            self.limit = max(self.min_concurrency, self.limit // 2)
+
+
+async def aembed_row(bedrock, model_id: str, row: pd.Series, limiter: AdaptiveLimiter, executor: ThreadPoolExecutor,
+                     max_attempts: int, base_delay: float, max_delay: float) -> Optional[np.ndarray]:
+    loop = asyncio.get_running_loop()
+    for attempt in range(max_attempts):
+        try:
+            async with limiter:
+                embeddings = await loop.run_in_executor(executor, embed_row, bedrock, model_id, row)
+            await limiter.on_success()
+            return embeddings
+        except ThrottledError as e:
+            await limiter.on_throttle()
+            # exponential backoff with full jitter
+            delay = random.uniform(0, min(max_delay, base_delay * (2 ** attempt)))
+            logger.warning(f"throttled ({e}) on {row['path_b64']}, attempt={attempt + 1}, "
+                           f"limit={limiter.limit}, sleeping {delay:.2f}s")
+            await asyncio.sleep(delay)
+        except Exception as e:
+            logger.error(f"exception while encoding image={row['path_b64']}, exception={e}")
+            return None
+    logger.error(f"giving up on image={row['path_b64']} after {max_attempts} throttled attempts")
+    return None
+
+
+def _load_checkpoint(index_fpath: str, data_fpath: str):
+    if not (os.path.exists(index_fpath) and os.path.exists(data_fpath)):
+        return None, []
+    index = faiss.read_index(index_fpath)
+    done = pd.read_csv(data_fpath)
+    if index.ntotal != len(done):
+        logger.warning(f"checkpoint mismatch, index has {index.ntotal} vectors but {data_fpath} has {len(done)} rows, starting over")
+        return None, []
+    logger.info(f"resuming from checkpoint with {index.ntotal} embeddings already in {index_fpath}")
+    return index, done.to_dict("records")
+
+
+def _save_checkpoint(index, rows: List, index_fpath: str, data_fpath: str):
+    # write to temp files and rename so an interrupted run never leaves a half written checkpoint
+    faiss.write_index(index, f"{index_fpath}.tmp")
+    pd.DataFrame(rows).to_csv(f"{data_fpath}.tmp", index=False)
+    os.replace(f"{index_fpath}.tmp", index_fpath)
+    os.replace(f"{data_fpath}.tmp", data_fpath)
+
+
+async def aembed_image_dataset(image_dataset: pd.DataFrame, bedrock, model_id: str, index_fpath: str, data_fpath: str,
+                               max_concurrency: int = 16, batch_size: int = 256, resume: bool = True,
+                               max_attempts: int = 8, base_delay: float = 0.5, max_delay: float = 20.0):
+    index, rows = _load_checkpoint(index_fpath, data_fpath) if resume else (None, [])
+    done_paths = {r["path_b64"] for r in rows}
+    pending = image_dataset[~image_dataset["path_b64"].isin(done_paths)]
+    logger.info(f"{len(done_paths)} images already embedded, {len(pending)} to go")
+
+    limiter = AdaptiveLimiter(max_concurrency)
+    # one thread per call the limiter can let through, asyncio.to_thread's default executor is capped at
+    # min(32, cpu_count + 4) threads and would queue calls the limiter already admitted
+    with ThreadPoolExecutor(max_workers=limiter.max_concurrency) as executor:
+        for start in range(0, len(pending), batch_size):
+            st = time.perf_counter()
+            batch = [row for _, row in pending.iloc[start:start + batch_size].iterrows()]
+            results = await asyncio.gather(*[aembed_row(bedrock, model_id, row, limiter, executor, max_attempts,
+                                                        base_delay, max_delay) for row in batch])
+            ok = [(row, e) for row, e in zip(batch, results) if e is not None]
+            if len(ok) > 0:
+                # one faiss add per batch instead of one per image
+                embeddings = np.vstack([e for _, e in ok])
+                if index is None:
+                    index = faiss.IndexFlatIP(embeddings.shape[1])
+                faiss.normalize_L2(embeddings)
+                index.add(embeddings)
+                rows.extend(row.to_dict() for row, _ in ok)
+                _save_checkpoint(index, rows, index_fpath, data_fpath)
+            elapsed = time.perf_counter() - st
+            logger.info(f"batch {start // batch_size}: embedded {len(ok)}/{len(batch)} in {elapsed:.2f}s "
+                        f"({len(batch) / elapsed:.1f} images/s), concurrency limit={limiter.limit}, "
+                        f"throttles so far={limiter.throttles}, total={len(rows)}")
+    return index, pd.DataFrame(rows)
+
+
+
+def embed_image_dataset(image_dataset: pd.DataFrame, index_fpath: str, data_fpath: str, model_id: str,
+                        bedrock=None, endpoint_url: Optional[str] = None, region_name: str = "us-east-1",
+                        max_concurrency: int = 16, batch_size: int = 256, resume: bool = True) -> Tuple:
+    """Embed every (image, description) row of image_dataset and ingest the vectors into a FAISS IndexFlatIP.
+
+    Rows are embedded with up to max_concurrency in-flight invoke_model calls, the concurrency adapts
+    down on throttling, and the index plus the successfully embedded rows are checkpointed to
+    index_fpath/data_fpath after every batch so that an interrupted run resumes where it left off.
+    Returns the index and a dataframe of the embedded rows, row i of which corresponds to vector i.
+    """
+    if bedrock is None:
+        bedrock = create_bedrock_client(endpoint_url, region_name, max_concurrency)
+    return asyncio.run(aembed_image_dataset(image_dataset, bedrock, model_id, index_fpath, data_fpath,
+                                            max_concurrency=max_concurrency, batch_size=batch_size, resume=resume))
+
+
+def embed_images(image_data_fname: str, index_fpath: str, data_fpath: str, model_id: str, endpoint_url: Optional[str],
+                 max_concurrency: int = 16, batch_size: int = 256):
+    # entry point for running as a script, see 1_multimodal_rag.ipynb, the dataset must have path_b64 and description columns
+    image_dataset = pd.read_csv(image_data_fname)
+    index, _ = embed_image_dataset(image_dataset, index_fpath, data_fpath, model_id, endpoint_url=endpoint_url,
+                                   max_concurrency=max_concurrency, batch_size=batch_size)
+    logger.info(f"there are {0 if index is None else index.ntotal} embeddings in {index_fpath}")
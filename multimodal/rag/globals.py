@@ -26,7 +26,10 @@ ACCEPT_ENCODING: str = "application/json"
 CONTENT_ENCODING: str = "application/json"
 VECTORDB_INDEX_FILE: str = f"aob_{LANGUAGE_TO_FILTER}_index"
 VECTOR_DB_INDEX_FPATH: str = os.path.join(VECTOR_DB_DIR, VECTORDB_INDEX_FILE)
+IMAGE_DATASET_TO_EMBED_FPATH: str = os.path.join(DATA_DIR, f"aob_{LANGUAGE_TO_FILTER}_to_embed.csv")
 K: int = 4
 N: int = 10000
+EMBEDDING_MAX_CONCURRENCY: int = 16
+EMBEDDING_BATCH_SIZE: int = 256
 MAX_IMAGE_HEIGHT: int = 2048
 MAX_IMAGE_WIDTH: int = 2048
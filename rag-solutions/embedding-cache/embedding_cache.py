@@ -0,0 +1,238 @@
+"""
+Embedding result cache keyed by (modelId, hash of the normalized input).
+
+Embeddings are deterministic for a given model and input, so re-ingesting a corpus only needs to call
+Bedrock for inputs that were never embedded before. The cache sits in front of either a LangChain
+embeddings object (`CachedEmbeddings`) or a raw `bedrock-runtime` client (`cached_invoke_model`) and
+stores vectors in a pluggable backend:
+
+- `LRUBackend`: in-process, bounded, for long running apps (Streamlit, notebooks)
+- `SQLiteBackend`: a local file shared by runs and processes on the same machine
+- `DynamoDBBackend`: a DynamoDB table, or DynamoDB Local (`docker run -p 8000:8000 amazon/dynamodb-local`)
+  as a stand-in while developing
+
+Every cache counts hits and misses in `cache.stats`.
+"""
+import json
+import time
+import sqlite3
+import hashlib
+import threading
+import unicodedata
+from array import array
+from collections import OrderedDict
+from typing import Dict, Iterable, List, Optional
+
+try:
+    from langchain.embeddings.base import Embeddings
+except ImportError:  # the cache also works for plain boto3 callers without langchain installed
+    Embeddings = object
+
+def normalize_text(text: str) -> str:
+    # the same text in different unicode forms or with surrounding whitespace embeds the same, so cache it once;
+    # whitespace inside the text is kept, line breaks and indentation can change the embedding
+    return unicodedata.normalize("NFC", text).strip()
+
+
+def cache_key(model_id: str, body: Dict) -> str:
+    """Hash of the model id and the request body with every string input normalized."""
+    normalized = {k: normalize_text(v) if k in ("inputText", "texts") and isinstance(v, str) else v for k, v in body.items()}
+    if isinstance(normalized.get("texts"), list):
+        normalized["texts"] = [normalize_text(t) for t in normalized["texts"]]
+    payload = json.dumps(normalized, sort_keys=True, ensure_ascii=False)
+    return hashlib.sha256(f"{model_id}\x00{payload}".encode("utf-8")).hexdigest()
+
+
+def encode_vector(vector: List[float]) -> bytes:
+    return array("f", vector).tobytes()
+
+
+def decode_vector(data: bytes) -> List[float]:
+    return array("f", data).tolist()
+
+
+class CacheStats:
+    def __init__(self):
+        self.hits = 0
+        self.misses = 0
+        self._lock = threading.Lock()
+
+    def record(self, hits: int, misses: int):
+        with self._lock:
+            self.hits += hits
+            self.misses += misses
+
+    @property
+    def hit_rate(self) -> float:
+        total = self.hits + self.misses
+        return self.hits / total if total else 0.0
+
+    def __repr__(self):
+        return f"CacheStats(hits={self.hits}, misses={self.misses}, hit_rate={self.hit_rate:.1%})"
+
+
+class LRUBackend:
+    def __init__(self, max_entries: int = 100_000):
+        self.max_entries = max_entries
+        self._data: "OrderedDict[str, bytes]" = OrderedDict()
+        self._lock = threading.Lock()
+
+    def get_many(self, keys: List[str]) -> Dict[str, bytes]:
+        found = {}
+        with self._lock:
+            for key in keys:
+                if key in self._data:
+                    self._data.move_to_end(key)
+                    found[key] = self._data[key]
+        return found
+
+    def put_many(self, items: Dict[str, bytes], model_id: str):
+        with self._lock:
+            for key, value in items.items():
+                self._data[key] = value
+                self._data.move_to_end(key)
+            while len(self._data) > self.max_entries:
+                self._data.popitem(last=False)
+
+
+class SQLiteBackend:
+    # sqlite limits the number of host parameters per statement, stay well below it
+    MAX_KEYS_PER_QUERY = 500
+
+    def __init__(self, path: str = "embedding_cache.db"):
+        self.path = path
+        self._local = threading.local()
+        conn = self._conn()
+        conn.execute("PRAGMA journal_mode=WAL")
+        conn.execute("CREATE TABLE IF NOT EXISTS embeddings "
+                     "(key TEXT PRIMARY KEY, model_id TEXT NOT NULL, vector BLOB NOT NULL, created_at REAL NOT NULL)")
+        conn.commit()
+
+    def _conn(self) -> sqlite3.Connection:
+        # one connection per thread, sqlite connections must not be shared across threads
+        conn = getattr(self._local, "conn", None)
+        if conn is None:
+            conn = sqlite3.connect(self.path, timeout=30)
+            self._local.conn = conn
+        return conn
+
+    def get_many(self, keys: List[str]) -> Dict[str, bytes]:
+        found = {}
+        conn = self._conn()
+        for start in range(0, len(keys), self.MAX_KEYS_PER_QUERY):
+            chunk = keys[start:start + self.MAX_KEYS_PER_QUERY]
+            rows = conn.execute(f"SELECT key, vector FROM embeddings WHERE key IN ({','.join('?' * len(chunk))})", chunk)
+            found.update(rows.fetchall())
+        return found
+
+    def put_many(self, items: Dict[str, bytes], model_id: str):
+        conn = self._conn()
+        now = time.time()
+        with conn:
+            conn.executemany("INSERT OR REPLACE INTO embeddings (key, model_id, vector, created_at) VALUES (?, ?, ?, ?)",
+                             [(key, model_id, value, now) for key, value in items.items()])
+
+
+class DynamoDBBackend:
+    # BatchGetItem takes at most 100 keys per request
+    MAX_KEYS_PER_BATCH = 100
+
+    def __init__(self, table_name: str, endpoint_url: Optional[str] = None, region_name: Optional[str] = None,
+                 create_table: bool = False):
+        import boto3
+        self.table_name = table_name
+        self.dynamodb = boto3.resource("dynamodb", endpoint_url=endpoint_url, region_name=region_name)
+        if create_table:
+            self._create_table()
+        self.table = self.dynamodb.Table(table_name)
+
+    def _create_table(self):
+        existing = [t.name for t in self.dynamodb.tables.all()]
+        if self.table_name in existing:
+            return
+        table = self.dynamodb.create_table(
+            TableName=self.table_name,
+            KeySchema=[{"AttributeName": "key", "KeyType": "HASH"}],
+            AttributeDefinitions=[{"AttributeName": "key", "AttributeType": "S"}],
+            BillingMode="PAY_PER_REQUEST",
+        )
+        table.wait_until_exists()
+
+    def get_many(self, keys: List[str]) -> Dict[str, bytes]:
+        found = {}
+        unique_keys = list(dict.fromkeys(keys))
+        for start in range(0, len(unique_keys), self.MAX_KEYS_PER_BATCH):
+            request = {self.table_name: {"Keys": [{"key": k} for k in unique_keys[start:start + self.MAX_KEYS_PER_BATCH]],
+                                         "ProjectionExpression": "#k, #v",
+                                         "ExpressionAttributeNames": {"#k": "key", "#v": "vector"}}}
+            while request:
+                response = self.dynamodb.batch_get_item(RequestItems=request)
+                for item in response["Responses"].get(self.table_name, []):
+                    found[item["key"]] = item["vector"].value  # boto3 wraps binary attributes in Binary
+                request = response.get("UnprocessedKeys")
+        return found
+
+    def put_many(self, items: Dict[str, bytes], model_id: str):
+        with self.table.batch_writer(overwrite_by_pkeys=["key"]) as batch:
+            for key, value in items.items():
+                batch.put_item(Item={"key": key, "model_id": model_id, "vector": value, "created_at": int(time.time())})
+
+
+class EmbeddingCache:
+    def __init__(self, backend=None):
+        self.backend = backend if backend is not None else LRUBackend()
+        self.stats = CacheStats()
+
+    def get_many(self, keys: List[str]) -> Dict[str, List[float]]:
+        found = self.backend.get_many(keys)
+        hits = sum(1 for k in keys if k in found)
+        self.stats.record(hits, len(keys) - hits)
+        return {k: decode_vector(v) for k, v in found.items()}
+
+    def put_many(self, vectors: Dict[str, List[float]], model_id: str):
+        if vectors:
+            self.backend.put_many({k: encode_vector(v) for k, v in vectors.items()}, model_id)
+
+    def get_or_compute(self, model_id: str, bodies: List[Dict], compute) -> List[List[float]]:
+        """Return one vector per request body, calling compute(missing_bodies) only for the cache misses."""
+        keys = [cache_key(model_id, b) for b in bodies]
+        found = self.get_many(keys)
+        missing = list(dict.fromkeys(k for k in keys if k not in found))
+        if missing:
+            body_by_key = dict(zip(keys, bodies))
+            computed = dict(zip(missing, compute([body_by_key[k] for k in missing])))
+            self.put_many(computed, model_id)
+            found.update(computed)
+        return [found[k] for k in keys]
+
+
+class CachedEmbeddings(Embeddings):
+    """A LangChain embeddings object that answers from the cache and only sends misses to the wrapped model."""
+
+    def __init__(self, embeddings, cache: Optional[EmbeddingCache] = None):
+        self.embeddings = embeddings
+        self.cache = cache if cache is not None else EmbeddingCache()
+
+    @property
+    def model_id(self) -> str:
+        return self.embeddings.model_id
+
+    def embed_documents(self, texts: List[str]) -> List[List[float]]:
+        return self.cache.get_or_compute(self.model_id, [{"inputText": t} for t in texts],
+                                         lambda bodies: self.embeddings.embed_documents([b["inputText"] for b in bodies]))
+
+    def embed_query(self, text: str) -> List[float]:
+        return self.cache.get_or_compute(self.model_id, [{"inputText": text}],
+                                         lambda bodies: [self.embeddings.embed_query(bodies[0]["inputText"])])[0]
+
+
+def cached_invoke_model(cache: EmbeddingCache, bedrock_runtime, model_id: str, body: Dict) -> List[float]:
+    """invoke_model for an embeddings model, the request body is the same dict you would json.dumps yourself."""
+    def compute(bodies: Iterable[Dict]) -> List[List[float]]:
+        vectors = []
+        for b in bodies:
+            response = bedrock_runtime.invoke_model(body=json.dumps(b), modelId=model_id,
+                                                    accept="application/json", contentType="application/json")
+            vectors.append(json.loads(response["body"].read())["embedding"])
+        return vectors
+    return cache.get_or_compute(model_id, [body], compute)[0]
@@ -0,0 +1,87 @@
+"""
+Compare one ospy_client.index() call per document (the original ingestion loop of multimodal-rag-pdf.ipynb)
+with bulk_ingest.bulk_ingest against a local OpenSearch container:
+
+    docker run -d -p 9200:9200 -e "discovery.type=single-node" -e "DISABLE_SECURITY_PLUGIN=true" opensearchproject/opensearch:2.11.0
+    python benchmark_bulk_ingest.py --count 5000 --workers 4
+
+The documents have the same shape as the ones built by prep_document in the notebook, with a random
+1536 dimension vector standing in for the Titan embedding.
+"""
+import time
+import random
+import logging
+import argparse
+from opensearchpy import OpenSearch
+from bulk_ingest import bulk_ingest
+
+logging.basicConfig(format='[%(asctime)s] p%(process)s {%(filename)s:%(lineno)d} %(levelname)s - %(message)s', level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+EMBEDDING_DIM = 1536
+
+
+def make_documents(count: int):
+    for i in range(count):
+        text = f"paragraph {i} " + "lorem ipsum dolor sit amet " * 40
+        yield {
+            "processed_element_embedding": [random.random() for _ in range(EMBEDDING_DIM)],
+            "processed_element": text,
+            "raw_element_type": "text",
+            "raw_element": text,
+            "src_doc": "data/benchmark.pdf",
+        }
+
+
+def create_index(client, index: str):
+    if client.indices.exists(index=index):
+        client.indices.delete(index=index)
+    client.indices.create(index=index, body={
+        "settings": {"index.knn": True},
+        "mappings": {"properties": {
+            "processed_element_embedding": {"type": "knn_vector", "dimension": EMBEDDING_DIM},
+            "processed_element": {"type": "text"},
+            "raw_element_type": {"type": "keyword"},
+            "raw_element": {"type": "text"},
+            "src_doc": {"type": "keyword"},
+        }},
+    })
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=9200)
+    parser.add_argument("--count", type=int, default=2000)
+    parser.add_argument("--workers", type=int, default=4)
+    parser.add_argument("--max-docs", type=int, default=500)
+    parser.add_argument("--max-bytes", type=int, default=5 * 1024 * 1024)
+    parser.add_argument("--skip-single", action="store_true", help="skip the one request per document baseline")
+    args = parser.parse_args()
+
+    client = OpenSearch(hosts=[{"host": args.host, "port": args.port}], pool_maxsize=args.workers * 2, timeout=120)
+    documents = list(make_documents(args.count))
+    results = {}
+
+    if not args.skip_single:
+        create_index(client, "benchmark-single")
+        st = time.perf_counter()
+        for doc in documents:
+            client.index(index="benchmark-single", body=doc)
+        client.indices.refresh(index="benchmark-single")
+        results["index() per doc"] = time.perf_counter() - st
+
+    create_index(client, "benchmark-bulk")
+    stats, elapsed = bulk_ingest(client, "benchmark-bulk", documents, max_docs=args.max_docs, max_bytes=args.max_bytes,
+                                 workers=args.workers)
+    results[f"bulk x{args.workers}"] = elapsed
+    count = client.count(index="benchmark-bulk")["count"]
+    logger.info(f"{stats}, {count} documents searchable in benchmark-bulk")
+
+    print(f"\n{'method':<18}{'seconds':>10}{'docs/s':>10}")
+    for name, elapsed in results.items():
+        print(f"{name:<18}{elapsed:>10.2f}{args.count / elapsed:>10.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,151 @@
+"""
+Bulk ingestion of the prepared documents into OpenSearch with the `_bulk` API.
+
+Documents are serialized once and packed into batches bounded both by document count and by request
+size, the batches are sent by a pool of parallel writers, and items rejected inside an otherwise
+successful bulk response (429 or 5xx) are retried individually with exponential backoff. Refresh is
+disabled on the index for the duration of the load and the previous setting restored afterwards.
+
+Each document gets a deterministic `_id`, the SHA-256 of its serialized source, so a retried document
+overwrites itself instead of being indexed twice. Amazon OpenSearch Serverless vector search collections
+do not accept custom document ids, pass document_ids=False for those: OpenSearch then assigns the ids and a
+document whose response was lost can be indexed twice. Serverless does not accept the refresh_interval
+setting either, a failure to change it is only logged.
+"""
+import json
+import hashlib
+import time
+import random
+import logging
+import threading
+from contextlib import contextmanager, nullcontext
+from concurrent.futures import ThreadPoolExecutor
+from typing import Dict, Iterable, Iterator, List, Tuple
+
+logger = logging.getLogger(__name__)
+
+RETRYABLE_STATUS = (429, 500, 502, 503, 504)
+
+
+class BulkStats:
+    def __init__(self):
+        self.indexed = 0
+        self.failed = 0
+        self.retried = 0
+        self.requests = 0
+        self.errors: List[Dict] = []
+        self._lock = threading.Lock()
+
+    def add(self, indexed: int = 0, failed: int = 0, retried: int = 0, requests: int = 0, errors: List[Dict] = ()):
+        with self._lock:
+            self.indexed += indexed
+            self.failed += failed
+            self.retried += retried
+            self.requests += requests
+            self.errors.extend(errors)
+
+    def __repr__(self):
+        return f"BulkStats(indexed={self.indexed}, failed={self.failed}, retried={self.retried}, requests={self.requests})"
+
+
+def _bulk_entry(index: str, source: str, document_ids: bool) -> str:
+    action = {"_index": index}
+    if document_ids:
+        action["_id"] = hashlib.sha256(source.encode("utf-8")).hexdigest()
+    return f"{json.dumps({'index': action})}\n{source}\n"
+
+
+def batch_documents(documents: Iterable[Dict], index: str, max_docs: int, max_bytes: int,
+                    document_ids: bool = True) -> Iterator[List[str]]:
+    """Serialize each document once and yield lists of _bulk entries (action and source lines) within both bounds."""
+    batch, size = [], 0
+    for doc in documents:
+        entry = _bulk_entry(index, json.dumps(doc), document_ids)
+        entry_bytes = len(entry.encode("utf-8"))
+        if batch and (len(batch) >= max_docs or size + entry_bytes > max_bytes):
+            yield batch
+            batch, size = [], 0
+        batch.append(entry)
+        size += entry_bytes
+    if batch:
+        yield batch
+
+
+def send_batch(client, entries: List[str], stats: BulkStats, max_retries: int, base_delay: float):
+    pending = entries
+    for attempt in range(max_retries + 1):
+        try:
+            response = client.bulk(body="".join(pending))
+        except Exception as e:
+            # the whole request failed (connection reset, 429 on the request, ...), retry all of it
+            status = getattr(e, "status_code", None)
+            if attempt == max_retries or (isinstance(status, int) and status not in RETRYABLE_STATUS):
+                logger.error(f"bulk request of {len(pending)} documents failed: {e}")
+                stats.add(failed=len(pending), requests=1, errors=[{"error": str(e)}])
+                return
+            stats.add(retried=len(pending), requests=1)
+            time.sleep(random.uniform(0, base_delay * (2 ** attempt)))
+            continue
+
+        retry, errors = [], []
+        if response.get("errors"):
+            for entry, item in zip(pending, response["items"]):
+                result = item.get("index") or item.get("create") or {}
+                status = result.get("status", 500)
+                if status < 300:
+                    continue
+                if status in RETRYABLE_STATUS and attempt < max_retries:
+                    retry.append(entry)
+                else:
+                    errors.append(result)
+        stats.add(indexed=len(pending) - len(retry) - len(errors), failed=len(errors), retried=len(retry),
+                  requests=1, errors=errors)
+        if not retry:
+            return
+        logger.warning(f"{len(retry)} of {len(pending)} documents rejected, retrying attempt={attempt + 1}")
+        pending = retry
+        time.sleep(random.uniform(0, base_delay * (2 ** attempt)))
+
+
+@contextmanager
+def refresh_disabled(client, index: str):
+    previous = None
+    try:
+        settings = client.indices.get_settings(index=index, name="index.refresh_interval")
+        previous = settings.get(index, {}).get("settings", {}).get("index", {}).get("refresh_interval")
+        client.indices.put_settings(index=index, body={"index": {"refresh_interval": "-1"}})
+        disabled = True
+    except Exception as e:
+        logger.info(f"could not disable refresh on {index}, continuing with the current setting: {e}")
+        disabled = False
+    try:
+        yield
+    finally:
+        if disabled:
+            # None resets the index to the cluster default when no interval was set explicitly
+            client.indices.put_settings(index=index, body={"index": {"refresh_interval": previous}})
+            client.indices.refresh(index=index)
+
+
+def bulk_ingest(client, index: str, documents: Iterable[Dict], max_docs: int = 500, max_bytes: int = 5 * 1024 * 1024,
+                workers: int = 4, max_retries: int = 5, base_delay: float = 0.5, disable_refresh: bool = True,
+                document_ids: bool = True) -> Tuple[BulkStats, float]:
+    """Index documents into index with parallel _bulk requests, returns the stats and the elapsed seconds."""
+    stats = BulkStats()
+    st = time.perf_counter()
+    with (refresh_disabled(client, index) if disable_refresh else nullcontext()):
+        with ThreadPoolExecutor(max_workers=workers) as executor:
+            # bound the number of queued batches so large inputs are not all serialized up front
+            in_flight = threading.BoundedSemaphore(workers * 2)
+            futures = []
+            for batch in batch_documents(documents, index, max_docs, max_bytes, document_ids):
+                in_flight.acquire()
+                future = executor.submit(send_batch, client, batch, stats, max_retries, base_delay)
+                future.add_done_callback(lambda _: in_flight.release())
+                futures.append(future)
+            for future in futures:
+                future.result()
+    elapsed = time.perf_counter() - st
+    logger.info(f"{stats} in {elapsed:.2f}s")
+    return stats, elapsed
+
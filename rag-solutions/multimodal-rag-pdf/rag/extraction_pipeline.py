@@ -0,0 +1,188 @@
+"""
+Pipelined ingestion for multimodal-rag-pdf.ipynb: parse -> summarize/caption -> embed -> index.
+
+The stages overlap instead of running one after the other for every element:
+
+- PDFs are parsed with `partition_pdf` in a pool of worker processes (parsing is CPU bound)
+- as soon as a PDF is parsed, its tables are summarized by the LLM and its images captioned, each
+  through its own bounded pool of async workers, while text paragraphs go straight on
+- every finished element is embedded (bounded concurrency as well) and queued for the sink, which
+  writes documents in batches (e.g. `bulk_ingest`) while the other stages keep working
+
+The model calls are passed in as plain functions (the notebook's invoke_llm_model, generate_image_captions,
+invoke_model and prep_document) and run in threads, so the pipeline itself has no model specific code.
+"""
+import os
+import time
+import asyncio
+import logging
+import multiprocessing
+from concurrent.futures import ProcessPoolExecutor
+from typing import Callable, Dict, List, Optional
+
+logger = logging.getLogger(__name__)
+
+_DONE = object()
+
+
+def partition_pdf_file(target_file: str, image_output_dir: str) -> Dict:
+    """Runs in a worker process, returns plain strings and paths so nothing unstructured specific crosses processes."""
+    from unstructured.partition.pdf import partition_pdf
+    image_output_dir_path = os.path.join(image_output_dir, os.path.splitext(os.path.basename(target_file))[0])
+    elements = partition_pdf(
+        filename=target_file,
+        extract_images_in_pdf=True,
+        infer_table_structure=True,
+        chunking_strategy="by_title", #Uses title elements to identify sections within the document for chunking
+        max_characters=4000,
+        new_after_n_chars=3800,
+        combine_text_under_n_chars=2000,
+        image_output_dir_path=image_output_dir_path,
+    )
+    tables, texts = [], []
+    for element in elements:
+        if "unstructured.documents.elements.Table" in str(type(element)):
+            tables.append(str(element))
+        elif "unstructured.documents.elements.CompositeElement" in str(type(element)):
+            texts.append(str(element))
+    images = [os.path.join(image_output_dir_path, f) for f in sorted(os.listdir(image_output_dir_path))] \
+        if os.path.isdir(image_output_dir_path) else []
+    return {"source": target_file, "tables": tables, "texts": texts, "images": images}
+
+
+class PipelineStats:
+    def __init__(self):
+        self.started = time.perf_counter()
+        self.counts = {"pdfs": 0, "texts": 0, "tables": 0, "images": 0, "indexed": 0, "failed": 0}
+        # seconds spent inside each stage summed over all workers, compare with wall_seconds to see the overlap
+        self.busy = {"parse": 0.0, "summarize": 0.0, "caption": 0.0, "embed": 0.0, "sink": 0.0}
+        self.wall_seconds = 0.0
+
+    def __repr__(self):
+        busy = ", ".join(f"{k}={v:.1f}s" for k, v in self.busy.items())
+        return f"PipelineStats({self.counts}, wall={self.wall_seconds:.1f}s, busy: {busy})"
+
+
+async def _timed(stats: PipelineStats, stage: str, fn: Callable, *args):
+    st = time.perf_counter()
+    try:
+        return await asyncio.to_thread(fn, *args)
+    finally:
+        stats.busy[stage] += time.perf_counter() - st
+
+
+def _failed_count(sink_result) -> int:
+    if isinstance(sink_result, tuple):
+        sink_result = sink_result[0]
+    return getattr(sink_result, "failed", 0)
+
+
+async def arun_pipeline(target_files: List[str], image_output_dir: str,
+                        summarize: Callable[[str], str], caption: Callable[[str], str], embed: Callable[[str], List[float]],
+                        prep_document: Callable, sink: Callable[[List[Dict]], object],
+                        parse_workers: int = 2, llm_concurrency: int = 4, caption_concurrency: int = 1,
+                        embed_concurrency: int = 8, sink_batch_size: int = 500, sink_concurrency: int = 4,
+                        sink_max_wait_seconds: float = 2.0, parse_fn: Optional[Callable[[str, str], Dict]] = None) -> PipelineStats:
+    """
+    summarize(table_text) -> summary, caption(image_path) -> caption, embed(text) -> vector,
+    prep_document(embedding, raw_element, processed_element, doc_type, src_doc) -> document,
+    sink(list_of_documents) is called from threads, up to sink_concurrency calls at a time, with a batch as soon as
+    it has sink_batch_size documents or its first document has waited sink_max_wait_seconds, so indexing starts with
+    the first elements instead of after the last one. It may return an object with a `failed` count, e.g.
+    bulk_ingest's (BulkStats, seconds), those documents are counted as failed. With bulk_ingest, a batch of its
+    max_docs (500 by default) is one _bulk request: call it with workers=1 and let sink_concurrency parallelize.
+    caption_concurrency defaults to 1 because the captioning model shares one GPU.
+    """
+    stats = PipelineStats()
+    parse_fn = parse_fn or partition_pdf_file
+    llm_sem = asyncio.Semaphore(llm_concurrency)
+    caption_sem = asyncio.Semaphore(caption_concurrency)
+    embed_sem = asyncio.Semaphore(embed_concurrency)
+    queue: asyncio.Queue = asyncio.Queue(maxsize=sink_batch_size * 2)
+    sink_slots = asyncio.Semaphore(sink_concurrency)
+
+    async def process_element(doc_type: str, raw_element: str, src_doc: str):
+        try:
+            if doc_type == "table":
+                async with llm_sem:
+                    processed = await _timed(stats, "summarize", summarize, raw_element)
+            elif doc_type == "image":
+                async with caption_sem:
+                    processed = await _timed(stats, "caption", caption, raw_element)
+                raw_element = processed  # the notebook stores the caption as the raw element of an image
+            else:
+                processed = raw_element
+            async with embed_sem:
+                embedding = await _timed(stats, "embed", embed, processed)
+            await queue.put(prep_document(embedding, raw_element, processed, doc_type, src_doc))
+            stats.counts[f"{doc_type}s"] += 1
+        except Exception as e:
+            stats.counts["failed"] += 1
+            logger.error(f"failed to process {doc_type} from {src_doc}: {e}")
+
+    async def parse_and_fan_out(executor: ProcessPoolExecutor, target_file: str):
+        loop = asyncio.get_running_loop()
+        st = time.perf_counter()
+        try:
+            parsed = await loop.run_in_executor(executor, parse_fn, target_file, image_output_dir)
+        except Exception as e:
+            stats.counts["failed"] += 1
+            logger.error(f"failed to parse {target_file}: {e}")
+            return
+        finally:
+            stats.busy["parse"] += time.perf_counter() - st
+        stats.counts["pdfs"] += 1
+        logger.info(f"parsed {target_file}: {len(parsed['texts'])} texts, {len(parsed['tables'])} tables, "
+                    f"{len(parsed['images'])} images")
+        src_doc = parsed["source"]
+        await asyncio.gather(*[process_element("text", t, src_doc) for t in parsed["texts"]],
+                             *[process_element("table", t, src_doc) for t in parsed["tables"]],
+                             *[process_element("image", i, src_doc) for i in parsed["images"]])
+
+    async def write(batch: List[Dict]):
+        try:
+            failed = _failed_count(await _timed(stats, "sink", sink, batch))
+            stats.counts["indexed"] += len(batch) - failed
+            stats.counts["failed"] += failed
+        except Exception as e:
+            # keep draining, a dead sink would block every producer on the full queue
+            stats.counts["failed"] += len(batch)
+            logger.error(f"sink failed for {len(batch)} documents: {e}")
+        finally:
+            sink_slots.release()
+
+    async def drain():
+        loop = asyncio.get_running_loop()
+        writes, batch, deadline, done = set(), [], 0.0, False
+        # the pending get is kept across timeouts, cancelling it could drop an element it already took
+        get = asyncio.ensure_future(queue.get())
+        while not done:
+            await asyncio.wait({get}, timeout=max(0.0, deadline - loop.time()) if batch else None)
+            timed_out = not get.done()
+            if not timed_out:
+                item = get.result()
+                if item is _DONE:
+                    done = True
+                else:
+                    if not batch:
+                        deadline = loop.time() + sink_max_wait_seconds
+                    batch.append(item)
+                    get = asyncio.ensure_future(queue.get())
+            if batch and (done or timed_out or len(batch) >= sink_batch_size):
+                # with sink_concurrency writes in flight, waiting for a slot holds the producers back
+                await sink_slots.acquire()
+                task = asyncio.create_task(write(batch))
+                writes.add(task)
+                task.add_done_callback(writes.discard)
+                batch = []
+        await asyncio.gather(*writes)
+
+    sink_task = asyncio.create_task(drain())
+    # spawn rather than fork, the notebook process has already initialized CUDA for the caption model
+    with ProcessPoolExecutor(max_workers=parse_workers, mp_context=multiprocessing.get_context("spawn")) as executor:
+        await asyncio.gather(*[parse_and_fan_out(executor, f) for f in target_files])
+    await queue.put(_DONE)
+    await sink_task
+    stats.wall_seconds = time.perf_counter() - stats.started
+    logger.info(stats)
+    return stats
@@ -0,0 +1,119 @@
+"""
+Compare a full rebuild of a LangChain FAISS store with an incremental update through index_manager.py
+after one document of the corpus changed.
+
+The corpus is data/book/book.txt and data/letter/2022.txt replicated --scales times (10x and 100x by
+default) as separate documents. Embeddings come from a local stand-in which returns deterministic vectors
+after a fixed per-chunk latency, so the benchmark needs no AWS account and measures what the rebuild
+would cost in Titan calls. Run from the workshop root:
+
+    python benchmark_index_manager.py --scales 10 100 --latency 0.005
+"""
+import os
+import time
+import hashlib
+import argparse
+import tempfile
+import numpy as np
+from typing import List
+from langchain.docstore.document import Document
+from langchain.embeddings.base import Embeddings
+from langchain.text_splitter import CharacterTextSplitter
+from langchain.vectorstores import FAISS
+from index_manager import IncrementalFaissIndex
+
+SOURCE_FILES = [os.path.join("data", "book", "book.txt"), os.path.join("data", "letter", "2022.txt")]
+
+
+class LatencyEmbeddings(Embeddings):
+    """Deterministic vectors derived from the text, with a sleep per text to stand in for the model call."""
+
+    def __init__(self, latency: float, dimension: int = 1536):
+        self.latency = latency
+        self.dimension = dimension
+        self.calls = 0
+
+    def _embed(self, text: str) -> List[float]:
+        self.calls += 1
+        time.sleep(self.latency)
+        seed = int.from_bytes(hashlib.sha256(text.encode("utf-8")).digest()[:4], "little")
+        return np.random.default_rng(seed).random(self.dimension).tolist()
+
+    def embed_documents(self, texts: List[str]) -> List[List[float]]:
+        return [self._embed(t) for t in texts]
+
+    def embed_query(self, text: str) -> List[float]:
+        return self._embed(text)
+
+
+def write_corpus(data_dir: str, scale: int):
+    for copy in range(scale):
+        for path in SOURCE_FILES:
+            with open(path, encoding="utf-8") as f:
+                text = f.read()
+            target = os.path.join(data_dir, f"copy{copy}", os.path.basename(path))
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            with open(target, "w", encoding="utf-8") as f:
+                f.write(text)
+
+
+def edit_one_document(data_dir: str):
+    # change a single paragraph of one letter, the kind of edit that used to force a full rebuild
+    path = os.path.join(data_dir, "copy0", "2022.txt")
+    with open(path, encoding="utf-8") as f:
+        lines = f.read().split("\n")
+    lines[len(lines) // 2] += " (updated)"
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("\n".join(lines))
+
+
+def full_rebuild(data_dir: str, index_dir: str, embeddings: Embeddings):
+    text_splitter = CharacterTextSplitter(separator="\n", chunk_size=1000, chunk_overlap=0)
+    docs = []
+    for root, _, files in os.walk(data_dir):
+        for name in sorted(files):
+            with open(os.path.join(root, name), encoding="utf-8") as f:
+                docs.append(Document(page_content=f.read(), metadata={"source": name}))
+    vs = FAISS.from_documents(text_splitter.split_documents(docs), embeddings)
+    vs.save_local(index_dir)
+    return vs.index.ntotal
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--scales", type=int, nargs="+", default=[10, 100])
+    parser.add_argument("--latency", type=float, default=0.005, help="stand-in embedding latency per chunk in seconds")
+    args = parser.parse_args()
+
+    print(f"{'scale':>6}{'chunks':>9}{'rebuild s':>11}{'rebuild calls':>15}{'incr s':>9}{'incr calls':>12}{'speedup':>9}")
+    for scale in args.scales:
+        with tempfile.TemporaryDirectory() as tmp:
+            data_dir = os.path.join(tmp, "data")
+            write_corpus(data_dir, scale)
+
+            # initial incremental build, not timed, this is the state an existing deployment is in
+            manager = IncrementalFaissIndex(os.path.join(tmp, "incremental"), LatencyEmbeddings(0.0))
+            manager.sync_directory(data_dir)
+            manager.save()
+
+            edit_one_document(data_dir)
+
+            embeddings = LatencyEmbeddings(args.latency)
+            st = time.perf_counter()
+            chunks = full_rebuild(data_dir, os.path.join(tmp, "rebuild"), embeddings)
+            rebuild_seconds, rebuild_calls = time.perf_counter() - st, embeddings.calls
+
+            embeddings = LatencyEmbeddings(args.latency)
+            st = time.perf_counter()
+            manager = IncrementalFaissIndex(os.path.join(tmp, "incremental"), embeddings)
+            manager.sync_directory(data_dir)
+            manager.save()
+            incremental_seconds, incremental_calls = time.perf_counter() - st, embeddings.calls
+            assert manager.vectorstore.index.ntotal == chunks, "incremental store diverged from the full rebuild"
+
+            print(f"{scale:>6}{chunks:>9}{rebuild_seconds:>11.2f}{rebuild_calls:>15}{incremental_seconds:>9.2f}"
+                  f"{incremental_calls:>12}{rebuild_seconds / incremental_seconds:>8.1f}x")
+
+
+if __name__ == "__main__":
+    main()
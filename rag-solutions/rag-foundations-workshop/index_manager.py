@@ -0,0 +1,250 @@
+"""
+Incremental maintenance of the LangChain FAISS stores used in this workshop (`faiss-index/langchain`, `faiss-diy`).
+
+The stores are kept in the regular `FAISS.save_local` format, so the notebooks keep loading them with
+`FAISS.load_local`, plus an `index_manifest.json` next to them which records, for every source document,
+the content hash of the file and the content hash and FAISS id of each of its chunks. When a document
+changes only its new or edited chunks are embedded, chunks that disappeared are removed by id, and
+unchanged chunks are left alone.
+
+Example (run from the workshop root):
+
+    python index_manager.py --data-dir data/letter --index-dir faiss-diy
+"""
+import os
+import json
+import glob
+import uuid
+import hashlib
+import argparse
+import faiss
+import numpy as np
+from typing import Dict, List, Optional
+from langchain.docstore.document import Document
+from langchain.docstore.in_memory import InMemoryDocstore
+from langchain.text_splitter import CharacterTextSplitter
+from langchain.vectorstores import FAISS
+
+MANIFEST_FILE = "index_manifest.json"
+LEGACY_DOCUMENT = "__legacy__"
+
+
+def content_hash(text: str) -> str:
+    return hashlib.sha256(text.encode("utf-8")).hexdigest()
+
+
+class IncrementalFaissIndex:
+    """
+    Wraps a LangChain FAISS vector store whose FAISS index is an `IndexIDMap2`, so chunks can be
+    added and removed by a stable 64-bit id instead of by position.
+
+    Removals are batched: `delete` and `upsert` only queue the ids, and `flush` removes all of them
+    from the FAISS index in a single `remove_ids` pass. `save` compacts the store, renumbering the
+    surviving ids to 0..n-1, once more than `compact_ratio` of the ids ever handed out have been
+    deleted, so the ids of a long lived store stay dense.
+    """
+
+    def __init__(self, index_dir: str, embedding_model, text_splitter: Optional[CharacterTextSplitter] = None,
+                 compact_ratio: float = 0.5):
+        self.index_dir = index_dir
+        self.embedding_model = embedding_model
+        self.text_splitter = text_splitter or CharacterTextSplitter(separator="\n", chunk_size=1000, chunk_overlap=0)
+        self.compact_ratio = compact_ratio
+        # {doc_key: {"file_hash": str, "chunks": [[chunk_hash, faiss_id], ...]}}
+        self.documents: Dict[str, Dict] = {}
+        self.next_id = 0
+        self.vs: Optional[FAISS] = None
+        self._pending_removals: List[int] = []
+        self.embedded_chunks = 0
+        self.reused_chunks = 0
+        if os.path.exists(os.path.join(index_dir, "index.faiss")):
+            self._load()
+
+    # ---------------------------------------------------------------- persistence
+
+    def _load(self):
+        self.vs = FAISS.load_local(self.index_dir, self.embedding_model)
+        manifest_path = os.path.join(self.index_dir, MANIFEST_FILE)
+        if os.path.exists(manifest_path):
+            with open(manifest_path) as f:
+                manifest = json.load(f)
+            self.documents = manifest["documents"]
+            self.next_id = manifest["next_id"]
+        else:
+            self._adopt_legacy_store()
+
+    def _adopt_legacy_store(self):
+        # a store built with FAISS.from_documents has positional ids, move its vectors into an IndexIDMap2
+        # and attribute all of its chunks to one pseudo document, nothing needs to be re-embedded
+        old = self.vs.index
+        vectors = old.reconstruct_n(0, old.ntotal)
+        ids = np.arange(old.ntotal, dtype=np.int64)
+        index = faiss.IndexIDMap2(faiss.IndexFlatL2(old.d))
+        index.add_with_ids(vectors, ids)
+        chunks = [[content_hash(self.vs.docstore.search(self.vs.index_to_docstore_id[i]).page_content), i]
+                  for i in range(old.ntotal)]
+        self.vs.index = index
+        self.documents = {LEGACY_DOCUMENT: {"file_hash": None, "chunks": chunks}}
+        self.next_id = old.ntotal
+
+    def save(self):
+        if self.vs is None:
+            # nothing was ever indexed (empty corpus), there is no store to write
+            return
+        self.flush()
+        if self._sparsity() > self.compact_ratio:
+            self.compact()
+        os.makedirs(self.index_dir, exist_ok=True)
+        self.vs.save_local(self.index_dir)
+        tmp = os.path.join(self.index_dir, MANIFEST_FILE + ".tmp")
+        with open(tmp, "w") as f:
+            json.dump({"documents": self.documents, "next_id": self.next_id}, f)
+        os.replace(tmp, os.path.join(self.index_dir, MANIFEST_FILE))
+
+    # ---------------------------------------------------------------- updates
+
+    def upsert(self, doc_key: str, text: str, metadata: Optional[Dict] = None, file_hash: Optional[str] = None) -> bool:
+        """Index `text` as document `doc_key`, returns False if the document was already up to date."""
+        file_hash = file_hash or content_hash(text)
+        previous = self.documents.get(doc_key)
+        if previous is not None and previous["file_hash"] == file_hash:
+            return False
+
+        metadata = dict(metadata or {}, source=doc_key)
+        chunks = self.text_splitter.split_documents([Document(page_content=text, metadata=metadata)])
+        hashes = [content_hash(c.page_content) for c in chunks]
+
+        # chunk hash -> ids of the unchanged chunks we can keep, a list because a chunk can repeat in a document
+        reusable: Dict[str, List[int]] = {}
+        for chunk_hash, faiss_id in (previous["chunks"] if previous else []):
+            reusable.setdefault(chunk_hash, []).append(faiss_id)
+        # chunks of an adopted legacy store are claimed by the first document that contains them
+        legacy: Dict[str, List[int]] = {}
+        for chunk_hash, faiss_id in self.documents.get(LEGACY_DOCUMENT, {}).get("chunks", []):
+            legacy.setdefault(chunk_hash, []).append(faiss_id)
+
+        kept, new_chunks = [], []
+        for chunk, chunk_hash in zip(chunks, hashes):
+            if reusable.get(chunk_hash):
+                kept.append([chunk_hash, reusable[chunk_hash].pop()])
+            elif legacy.get(chunk_hash):
+                kept.append([chunk_hash, legacy[chunk_hash].pop()])
+            else:
+                new_chunks.append((chunk, chunk_hash))
+        self._remove([faiss_id for ids in reusable.values() for faiss_id in ids])
+        if LEGACY_DOCUMENT in self.documents:
+            self.documents[LEGACY_DOCUMENT]["chunks"] = [[h, i] for h, ids in legacy.items() for i in ids]
+
+        added = self._add([c for c, _ in new_chunks])
+        self.documents[doc_key] = {"file_hash": file_hash,
+                                   "chunks": kept + [[h, faiss_id] for (_, h), faiss_id in zip(new_chunks, added)]}
+        self.reused_chunks += len(kept)
+        self.embedded_chunks += len(new_chunks)
+        return True
+
+    def delete(self, doc_key: str) -> bool:
+        previous = self.documents.pop(doc_key, None)
+        if previous is None:
+            return False
+        self._remove([faiss_id for _, faiss_id in previous["chunks"]])
+        return True
+
+    def sync_directory(self, data_dir: str, pattern: str = "**/*.txt") -> Dict[str, int]:
+        """Bring the store in line with the files under data_dir: upsert changed files, delete removed ones.
+
+        data_dir is treated as the whole corpus, so documents that are not found there are deleted from the store.
+        """
+        stats = {"unchanged": 0, "upserted": 0, "deleted": 0}
+        seen = set()
+        for path in sorted(glob.glob(os.path.join(data_dir, pattern), recursive=True)):
+            doc_key = os.path.relpath(path, data_dir)
+            seen.add(doc_key)
+            with open(path, encoding="utf-8") as f:
+                text = f.read()
+            stats["upserted" if self.upsert(doc_key, text) else "unchanged"] += 1
+        # legacy chunks that no file claimed are no longer part of the corpus either
+        for doc_key in [k for k in self.documents if k not in seen]:
+            self.delete(doc_key)
+            stats["deleted"] += 1
+        self.flush()
+        return stats
+
+    def _add(self, chunks: List[Document]) -> List[int]:
+        if not chunks:
+            return []
+        vectors = np.array(self.embedding_model.embed_documents([c.page_content for c in chunks]), dtype=np.float32)
+        ids = list(range(self.next_id, self.next_id + len(chunks)))
+        self.next_id += len(chunks)
+        if self.vs is None:
+            index = faiss.IndexIDMap2(faiss.IndexFlatL2(vectors.shape[1]))
+            self.vs = FAISS(self.embedding_model, index, InMemoryDocstore({}), {})
+        self.vs.index.add_with_ids(vectors, np.array(ids, dtype=np.int64))
+        docstore_ids = [str(uuid.uuid4()) for _ in chunks]
+        self.vs.docstore.add(dict(zip(docstore_ids, chunks)))
+        self.vs.index_to_docstore_id.update(zip(ids, docstore_ids))
+        return ids
+
+    def _remove(self, ids: List[int]):
+        self._pending_removals.extend(ids)
+
+    def flush(self):
+        # one remove_ids pass over the flat index for however many chunks were dropped since the last flush
+        if not self._pending_removals:
+            return
+        self.vs.index.remove_ids(np.array(self._pending_removals, dtype=np.int64))
+        for faiss_id in self._pending_removals:
+            docstore_id = self.vs.index_to_docstore_id.pop(faiss_id)
+            self.vs.docstore._dict.pop(docstore_id, None)
+        self._pending_removals = []
+
+    # ---------------------------------------------------------------- compaction
+
+    def _sparsity(self) -> float:
+        if self.vs is None or self.next_id == 0:
+            return 0.0
+        return 1.0 - self.vs.index.ntotal / self.next_id
+
+    def compact(self):
+        """Renumber the chunk ids to 0..n-1 and rebuild the id map, vectors are copied, not re-embedded."""
+        self.flush()
+        old = self.vs.index
+        old_ids = faiss.vector_to_array(old.id_map)
+        vectors = old.index.reconstruct_n(0, old.ntotal)
+        remap = {int(old_id): new_id for new_id, old_id in enumerate(old_ids)}
+
+        index = faiss.IndexIDMap2(faiss.IndexFlatL2(old.d))
+        index.add_with_ids(vectors, np.arange(len(old_ids), dtype=np.int64))
+        self.vs.index = index
+        self.vs.index_to_docstore_id = {remap[i]: d for i, d in self.vs.index_to_docstore_id.items()}
+        for doc in self.documents.values():
+            doc["chunks"] = [[h, remap[i]] for h, i in doc["chunks"]]
+        self.next_id = len(old_ids)
+
+    @property
+    def vectorstore(self) -> FAISS:
+        self.flush()
+        return self.vs
+
+
+def main():
+    import boto3
+    from langchain.embeddings import BedrockEmbeddings
+
+    parser = argparse.ArgumentParser(description="Incrementally update a LangChain FAISS store from a folder of text files")
+    parser.add_argument("--data-dir", required=True)
+    parser.add_argument("--index-dir", required=True)
+    parser.add_argument("--pattern", default="**/*.txt")
+    parser.add_argument("--model-id", default="amazon.titan-embed-text-v1")
+    args = parser.parse_args()
+
+    embedding_model = BedrockEmbeddings(client=boto3.client(service_name="bedrock-runtime"), model_id=args.model_id)
+    manager = IncrementalFaissIndex(args.index_dir, embedding_model)
+    stats = manager.sync_directory(args.data_dir, args.pattern)
+    manager.save()
+    total = manager.vectorstore.index.ntotal if manager.vectorstore is not None else 0
+    print(f"{stats}, embedded {manager.embedded_chunks} chunks, reused {manager.reused_chunks}, "
+          f"{total} chunks in {args.index_dir}")
+
+
+if __name__ == "__main__":
+    main()
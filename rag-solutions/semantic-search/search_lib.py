@@ -1,28 +1,149 @@
+import os
+import sys
+import json
+import hashlib
+import faiss
+import numpy as np
+from langchain.docstore.document import Document
+from langchain.docstore.in_memory import InMemoryDocstore
 from langchain.embeddings import BedrockEmbeddings
-from langchain.indexes import VectorstoreIndexCreator
+from langchain.indexes.vectorstore import VectorStoreIndexWrapper
 from langchain.vectorstores import FAISS
 from langchain.text_splitter import CharacterTextSplitter
 from langchain.document_loaders.csv_loader import CSVLoader
 
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "embedding-cache"))
+from embedding_cache import CachedEmbeddings, EmbeddingCache, SQLiteBackend
+
+
+SOURCE_FILE = "bedrock_faqs.csv"
+INDEX_DIR = "index_cache" #the persisted index, docstore and manifest live here
+EMBEDDING_CACHE_FILE = "embedding_cache.db" #vectors for every text ever embedded, shared with other runs of the app
+CHUNK_SIZE = 300
+
+
+def get_file_hash(file_path):
+    sha = hashlib.sha256()
+    with open(file_path, "rb") as f:
+        for block in iter(lambda: f.read(1024 * 1024), b""):
+            sha.update(block)
+    return sha.hexdigest()
+
+
+def get_chunk_hash(chunk):
+    return hashlib.sha256(chunk.page_content.encode("utf-8")).hexdigest()
+
+
+def read_faiss_index(index_path): #memory-map the vectors of the flat index instead of copying them into the process (IO_FLAG_MMAP_IFC needs faiss 1.8, IO_FLAG_MMAP does not map flat indexes)
+    try:
+        return faiss.read_index(index_path, faiss.IO_FLAG_MMAP_IFC | faiss.IO_FLAG_READ_ONLY)
+    except RuntimeError:
+        return faiss.read_index(index_path)
+
+
+def load_persisted_index(index_dir):
+    with open(os.path.join(index_dir, "manifest.json")) as f:
+        manifest = json.load(f)
+
+    with open(os.path.join(index_dir, "docstore.json")) as f:
+        entries = json.load(f) #one entry per vector, in index order
+
+    index = read_faiss_index(os.path.join(index_dir, "index.faiss"))
+
+    return manifest, entries, index
+
+
+def write_json(path, data):
+    with open(path, "w") as f:
+        json.dump(data, f)
+
+
+def save_persisted_index(index_dir, manifest, entries, index): #write to temp files then rename so a crash never leaves a torn cache
+    os.makedirs(index_dir, exist_ok=True)
+
+    files = {
+        "index.faiss": lambda path: faiss.write_index(index, path),
+        "docstore.json": lambda path: write_json(path, entries),
+        "manifest.json": lambda path: write_json(path, manifest), #written last so it only ever describes complete files
+    }
+
+    for name, write in files.items():
+        path = os.path.join(index_dir, name)
+        write(path + ".tmp")
+        os.replace(path + ".tmp", path)
+
+
+def to_vectorstore(embeddings, entries, index):
+    documents = {str(i): Document(page_content=e["content"], metadata=e["metadata"]) for i, e in enumerate(entries)}
+
+    vectorstore = FAISS(embeddings, index, InMemoryDocstore(documents), {i: str(i) for i in range(len(entries))})
+
+    return VectorStoreIndexWrapper(vectorstore=vectorstore)
+
+
+def build_index(embeddings, chunks, previous): #re-embed only the chunks whose content is not already in the previous index
+    known_vectors = {}
+
+    if previous is not None:
+        _, old_entries, old_index = previous
+        old_vectors = old_index.reconstruct_n(0, old_index.ntotal)
+        known_vectors = {e["hash"]: old_vectors[i] for i, e in enumerate(old_entries)}
+
+    hashes = [get_chunk_hash(c) for c in chunks]
+
+    new_positions = [i for i, h in enumerate(hashes) if h not in known_vectors]
+    new_vectors = embeddings.embed_documents([chunks[i].page_content for i in new_positions]) if new_positions else []
+
+    vectors = [known_vectors.get(h) for h in hashes]
+    for i, v in zip(new_positions, new_vectors):
+        vectors[i] = v
+
+    print(f"Index rebuild: {len(chunks) - len(new_positions)} chunks reused, {len(new_positions)} chunks embedded")
+
+    vectors = np.array(vectors, dtype=np.float32)
+    index = faiss.IndexFlatL2(vectors.shape[1]) #same index type FAISS.from_documents would have built
+    index.add(vectors)
+
+    entries = [{"hash": h, "content": c.page_content, "metadata": c.metadata} for h, c in zip(hashes, chunks)]
+
+    return entries, index
+
+
+def get_index(): #returns a vector store backed by a persisted index, only re-embedding what changed in the source file
+
+    embeddings = CachedEmbeddings(BedrockEmbeddings(), EmbeddingCache(SQLiteBackend(EMBEDDING_CACHE_FILE))) #create a Titan Embeddings client, answering repeated texts from the cache
+
+    source_hash = get_file_hash(SOURCE_FILE)
+
+    previous = None
+    if os.path.exists(os.path.join(INDEX_DIR, "manifest.json")):
+        previous = load_persisted_index(INDEX_DIR)
+        manifest = previous[0]
+
+        if (manifest["source_hash"] == source_hash and manifest["model_id"] == embeddings.model_id
+                and manifest["chunk_size"] == CHUNK_SIZE): #source unchanged, serve the persisted index as-is
+            return to_vectorstore(embeddings, previous[1], previous[2])
+
+        if manifest["model_id"] != embeddings.model_id: #vectors from another model can't be reused
+            previous = None
+
+    loader = CSVLoader(file_path=SOURCE_FILE)
 
-def get_index(): #creates and returns an in-memory vector store to be used in the application
-    
-    embeddings = BedrockEmbeddings() #create a Titan Embeddings client
-    
-    loader = CSVLoader(file_path="bedrock_faqs.csv")
-    
     documents = loader.load()
 
-    index_creator = VectorstoreIndexCreator(
-        vectorstore_cls=FAISS,
-        embedding=embeddings,
-        text_splitter=CharacterTextSplitter(chunk_size=300, chunk_overlap=0),
-    )
+    text_splitter = CharacterTextSplitter(chunk_size=CHUNK_SIZE, chunk_overlap=0)
+
+    chunks = text_splitter.split_documents(documents)
+
+    entries, index = build_index(embeddings, chunks, previous)
+
+    manifest = {"source_hash": source_hash, "model_id": embeddings.model_id, "chunk_size": CHUNK_SIZE}
+    save_persisted_index(INDEX_DIR, manifest, entries, index)
+
+    print(f"Embedding cache: {embeddings.cache.stats}")
+
+    return to_vectorstore(embeddings, entries, index)
 
-    index_from_loader = index_creator.from_loaders([loader])
-    
-    return index_from_loader
-    
 
 def get_similarity_search_results(index, question):
     results = index.vectorstore.similarity_search_with_score(question)
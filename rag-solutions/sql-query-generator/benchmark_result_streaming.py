@@ -0,0 +1,107 @@
+"""
+Time and peak memory of a generated `SELECT * FROM [Order Details]` on a synthetic Northwind whose Order Details
+table is scaled to N rows, comparing fetchall into a DataFrame (the previous behaviour) with the streamed
+Arrow record batches of sqlite_helper.ResultStream and with one page of the chat UI (LIMIT injection):
+
+    python benchmark_result_streaming.py --rows 10000000
+
+The database is generated once into --db (about 400 MB for 10M rows) and reused by later runs. Every mode runs
+in its own process so its peak RSS is measured on its own.
+"""
+import os
+import sys
+import json
+import time
+import sqlite3
+import argparse
+import resource
+import subprocess
+import sqlite_helper
+
+QUERY = "SELECT * FROM [Order Details]"
+PAGE_SIZE = 100
+
+
+def build_database(db_file, rows):
+    if os.path.exists(db_file):
+        conn = sqlite3.connect(db_file)
+        count = conn.execute("SELECT count(*) FROM [Order Details]").fetchone()[0]
+        conn.close()
+        if count == rows:
+            return
+        os.remove(db_file)
+    print(f"generating {rows} order details into {db_file}")
+    conn = sqlite3.connect(db_file)
+    conn.execute("PRAGMA journal_mode=OFF")
+    conn.execute("""CREATE TABLE [Order Details] (OrderID INTEGER NOT NULL, ProductID INTEGER NOT NULL,
+                    UnitPrice NUMERIC NOT NULL, Quantity INTEGER NOT NULL, Discount REAL NOT NULL)""")
+    # about three lines per order over the 77 Northwind products, same columns as northwind.db
+    conn.execute("""WITH RECURSIVE seq(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM seq WHERE x < ?)
+                    INSERT INTO [Order Details]
+                    SELECT 10248 + x / 3, 1 + x % 77, round(2.5 + (x * 7919 % 26000) / 100.0, 2),
+                           1 + x * 31 % 120, (x % 5) * 0.05 FROM seq""", (rows - 1,))
+    conn.commit()
+    conn.close()
+
+
+def run_fetchall(pool):
+    import pandas as pd
+    with pool.connection() as conn:
+        cur = conn.execute(QUERY)
+        df = pd.DataFrame(cur.fetchall(), columns=[col[0] for col in cur.description])
+    return len(df)
+
+
+def run_stream(pool):
+    rows = 0
+    with pool.stream(QUERY, timeout=3600, max_bytes=float("inf")) as result:
+        for batch in result:
+            rows += batch.num_rows  # a consumer writing batches out (to a file, over the network) holds one at a time
+    return rows
+
+
+def run_page(pool, offset):
+    with pool.stream(QUERY, limit=PAGE_SIZE + 1, offset=offset, batch_rows=PAGE_SIZE + 1) as result:
+        return sum(batch.to_pandas().shape[0] for batch in result)
+
+
+def run_mode(db_file, mode, rows):
+    pool = sqlite_helper.ReadOnlyConnectionPool(db_file=db_file, size=1)
+    st = time.perf_counter()
+    if mode == "fetchall":
+        count = run_fetchall(pool)
+    elif mode == "stream":
+        count = run_stream(pool)
+    elif mode == "first page":
+        count = run_page(pool, 0)
+    else:
+        count = run_page(pool, rows // 2)
+    elapsed = time.perf_counter() - st
+    # ru_maxrss is in KB on Linux
+    print(json.dumps({"seconds": elapsed, "rows": count, "peak_mb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024}))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--rows", type=int, default=10_000_000)
+    parser.add_argument("--db", default="northwind_scaled.db")
+    parser.add_argument("--skip-fetchall", action="store_true", help="skip the baseline, it needs several GB of memory at 10M rows")
+    parser.add_argument("--run", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.run:
+        run_mode(args.db, args.run, args.rows)
+        return
+
+    build_database(args.db, args.rows)
+    modes = ["stream", "first page", "middle page"] if args.skip_fetchall else ["fetchall", "stream", "first page", "middle page"]
+    print(f"{'mode':<14}{'rows':>12}{'seconds':>10}{'peak MB':>10}")
+    for mode in modes:
+        out = subprocess.run([sys.executable, __file__, "--db", args.db, "--rows", str(args.rows), "--run", mode],
+                             capture_output=True, text=True, check=True).stdout
+        result = json.loads(out.strip().splitlines()[-1])
+        print(f"{mode:<14}{result['rows']:>12}{result['seconds']:>10.2f}{result['peak_mb']:>10.1f}")
+
+
+if __name__ == "__main__":
+    main()
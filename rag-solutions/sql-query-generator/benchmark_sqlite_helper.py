@@ -0,0 +1,73 @@
+"""
+Queries per second of the SQLite access in sqlite_helper.py under N concurrent sessions, comparing a new
+sqlite3.connect per query (the previous behaviour) with the shared read-only connection pool:
+
+    python benchmark_sqlite_helper.py --sessions 1 4 16 --seconds 5
+"""
+import time
+import sqlite3
+import argparse
+import threading
+import sqlite_helper
+
+# the kind of queries the chain generates, from point lookups to a scan of Order Details
+QUERIES = [
+    "SELECT ProductName, UnitPrice FROM Products ORDER BY UnitPrice DESC LIMIT 5",
+    "SELECT * FROM Customers WHERE Country = 'Germany'",
+    "SELECT c.CategoryName, COUNT(*) FROM Categories c JOIN Products p ON c.CategoryID = p.CategoryID GROUP BY c.CategoryName",
+    "SELECT OrderID, OrderDate FROM Orders WHERE OrderID = 10248",
+    "SELECT COUNT(*) FROM [Order Details] WHERE Quantity > 100",
+]
+
+
+def connect_per_query(query):
+    # sqlite_helper.run_query before the pool
+    conn = sqlite3.connect(sqlite_helper.DB_FILE)
+    try:
+        with conn:
+            cur = conn.cursor()
+            cur.execute(query)
+            return [col[0] for col in cur.description], cur.fetchall()
+    finally:
+        conn.close()
+
+
+def pooled(query):
+    return sqlite_helper.run_query(query)
+
+
+def measure(fn, sessions, seconds):
+    counts = [0] * sessions
+    stop = time.monotonic() + seconds
+
+    def session(i):
+        n = 0
+        while time.monotonic() < stop:
+            fn(QUERIES[n % len(QUERIES)])
+            n += 1
+        counts[i] = n
+
+    threads = [threading.Thread(target=session, args=(i,)) for i in range(sessions)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return sum(counts) / seconds
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sessions", type=int, nargs="+", default=[1, 4, 16])
+    parser.add_argument("--seconds", type=float, default=5)
+    args = parser.parse_args()
+
+    sqlite_helper.get_pool()  # open the pool up front, like the app does on its first query
+    print(f"{'sessions':>8}{'connect/query qps':>20}{'pooled qps':>14}{'speedup':>10}")
+    for sessions in args.sessions:
+        baseline = measure(connect_per_query, sessions, args.seconds)
+        pool = measure(pooled, sessions, args.seconds)
+        print(f"{sessions:>8}{baseline:>20.1f}{pool:>14.1f}{pool / baseline:>9.1f}x")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,8 +1,14 @@
 import streamlit as st
 import sql_query_chain
 import re
+import time
 import sqlite_helper
 import pandas as pd
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
+
+PAGE_SIZE = 100
+SESSION_MAX_RESULT_BYTES = 64 * 1024 * 1024  # result pages kept per session, the least recently viewed are dropped first
 
 
 def ask_question(question):
@@ -13,19 +19,101 @@ def is_query_present(response):
     pattern = r'\bSQLQuery:\s*(.+)'
     return re.search(pattern, response, re.IGNORECASE | re.DOTALL)
 
-def extract_query(ai_response):
-    query_text = ""
-    pattern = r'\bSQLQuery:\s*(.+)'
-    match = re.search(pattern, response, re.IGNORECASE | re.DOTALL)
-    if match:
-        query_text = match.group(1).strip()
-    return query_text
+def fetch_page(query, page):
+    """
+    Runs the query for one page of rows, returns (DataFrame, has_more, nbytes, truncated) or None if the query failed.
+    truncated is set when the rows stopped at SESSION_MAX_RESULT_BYTES rather than at the end of the page.
+    """
+    try:
+        # one row past the page tells whether there is a next page
+        with sqlite_helper.stream_query(query, limit=PAGE_SIZE + 1, offset=page * PAGE_SIZE, batch_rows=PAGE_SIZE + 1,
+                                        max_bytes=SESSION_MAX_RESULT_BYTES) as result:
+            frames = [batch.to_pandas() for batch in result]
+    except Exception:
+        return None
+    df = pd.concat(frames, ignore_index=True) if frames else pd.DataFrame(columns=result.column_names)
+    if result.limited:
+        df, has_more = df.iloc[:PAGE_SIZE], len(df) > PAGE_SIZE
+    else:
+        # not a plain SELECT, so no LIMIT could be added: everything up to the byte cap is shown on one page
+        has_more = False
+    return df, has_more, int(df.memory_usage(deep=True).sum()), result.truncated
+
+def remember_page(query, page, result):
+    pages = st.session_state.setdefault("result_pages", OrderedDict())
+    pages[(query, page)] = result
+    pages.move_to_end((query, page))
+    while len(pages) > 1 and sum(r[2] for r in pages.values() if r is not None) > SESSION_MAX_RESULT_BYTES:
+        pages.popitem(last=False)
+
+def get_page(query, page):
+    pages = st.session_state.setdefault("result_pages", OrderedDict())
+    if (query, page) in pages:
+        pages.move_to_end((query, page))
+        return pages[(query, page)]
+    result = fetch_page(query, page)
+    remember_page(query, page, result)
+    return result
+
+def change_page(page_key, step):
+    st.session_state[page_key] += step
+
+def show_result(index, query):
+    """Shows the current page of a query result with previous/next buttons, index keeps the widgets of each result apart."""
+    page_key = f"result_page_{index}"
+    page = st.session_state.setdefault(page_key, 0)
+    result = get_page(query, page)
+    if result is None:
+        return
+    df, has_more, _, truncated = result
+    st.dataframe(df)
+    if truncated:
+        st.caption(f"Results truncated: {len(df)} rows shown, the rest did not fit in "
+                   f"{SESSION_MAX_RESULT_BYTES // (1024 * 1024)} MB.")
+    if page > 0 or has_more:
+        previous_col, next_col, position_col = st.columns([1, 1, 4])
+        previous_col.button("Previous", key=f"previous_{index}", disabled=page == 0,
+                            on_click=change_page, args=(page_key, -1))
+        next_col.button("Next", key=f"next_{index}", disabled=not has_more,
+                        on_click=change_page, args=(page_key, 1))
+        position_col.caption(f"Rows {page * PAGE_SIZE + 1}-{page * PAGE_SIZE + len(df)}")
+
+def has_rows(result):
+    return result is not None and not result[0].empty
+
+@st.cache_resource
+def get_query_executor():
+    # shared by all sessions, runs generated queries while the model is still streaming its response
+    return ThreadPoolExecutor(max_workers=4)
+
+def stream_answer(question, message_placeholder):
+    """Streams the response into the placeholder and starts the query as soon as it is complete.
+
+    Returns the full response, the query and a future for its first page (or None) and the latency metrics of the turn.
+    """
+    start = time.perf_counter()
+    ttft = None
+    full_response = ""
+    query = ""
+    query_future = None
+    for chunk in sql_query_chain.sql_chain_stream(question):
+        if ttft is None:
+            ttft = time.perf_counter() - start
+        full_response += chunk
+        message_placeholder.code(full_response + "▌", language="sql")
+        if query_future is None:
+            query = sqlite_helper.extract_query(full_response, complete=False)
+            if query:
+                query_future = get_query_executor().submit(fetch_page, query, 0)
+    message_placeholder.code(full_response, language="sql")
+    total = time.perf_counter() - start
+    if query_future is None and is_query_present(full_response):
+        query = sqlite_helper.extract_query(full_response)
+        if query:
+            query_future = get_query_executor().submit(fetch_page, query, 0)
+    return full_response, query, query_future, {"ttft": ttft or total, "total": total}
 
-def run_query(query):
-    status, columns, query_result = sqlite_helper.run_query(query)
-    if query_result and status=="success":
-        df = pd.DataFrame(query_result)
-        return df
+stream_responses = st.sidebar.checkbox("Stream responses", value=True)
 
 # Initialize chat history
 hello_message = f"""Hello 👋. I am SQL assistant. I can take a natural language question as input, analyze the intent and context, and generate a valid SQLite query that answers the question based on the [Nortwhind](https://docs.yugabyte.com/preview/sample-data/northwind/) dataset. Feel free to ask any questions along those lines!
@@ -45,10 +133,12 @@ if "messages" not in st.session_state:
     st.session_state.messages = [{"role": "assistant", "content": hello_message, "type": "text"}]
 
 # Display chat messages from history on app rerun
-for message in st.session_state.messages:
+for index, message in enumerate(st.session_state.messages):
     with st.chat_message(message["role"]):
         if message.get("type", "text") == "code":
             st.code(message["content"], language="sql")
+        elif message["type"] == "result":
+            show_result(index, message["content"])
         else:
             st.markdown(message["content"])
 
@@ -61,25 +151,33 @@ if prompt:
     with st.chat_message("user"):
         st.markdown(prompt)
     # Display assistant response in chat message container
-    with st.chat_message("assistant"):
-        message_placeholder = st.empty()
-        full_response = ""
-        response_list = []
-        response = ask_question(prompt)
-        response_list.append(response)
-
-        for response in response_list:
-            full_response += response
-            message_placeholder.code(full_response + "▌", language="sql")
-        message_placeholder.code(full_response, language="sql")
-    
-    with st.chat_message("assistant"):
-        message_placeholder = st.empty()
-        if is_query_present(response):
-            query = extract_query(response)
-            if query:
-               df = run_query(query=query)
-               if df is not None and not df.empty:
-                   message_placeholder.dataframe(df)
-    
+    if stream_responses:
+        with st.chat_message("assistant"):
+            message_placeholder = st.empty()
+            full_response, query, query_future, latency = stream_answer(prompt, message_placeholder)
+            st.caption(f"Time to first token: {latency['ttft']:.2f}s, total: {latency['total']:.2f}s")
+        if query_future is not None:
+            remember_page(query, 0, query_future.result())
+    else:
+        with st.chat_message("assistant"):
+            message_placeholder = st.empty()
+            start = time.perf_counter()
+            full_response = ""
+            response_list = []
+            response = ask_question(prompt)
+            response_list.append(response)
+
+            for response in response_list:
+                full_response += response
+                message_placeholder.code(full_response + "▌", language="sql")
+            message_placeholder.code(full_response, language="sql")
+            total = time.perf_counter() - start
+            st.caption(f"Time to first token: {total:.2f}s, total: {total:.2f}s")
+
+        query = sqlite_helper.extract_query(response) if is_query_present(response) else ""
+
     st.session_state.messages.append({"role": "assistant", "content": full_response, "type": "code"})
+    if query and has_rows(get_page(query, 0)):
+        with st.chat_message("assistant"):
+            show_result(len(st.session_state.messages), query)
+        st.session_state.messages.append({"role": "assistant", "content": query, "type": "result"})
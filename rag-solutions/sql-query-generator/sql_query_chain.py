@@ -1,3 +1,11 @@
+import hashlib
+import math
+import os
+import re
+import sys
+import threading
+from collections import OrderedDict
+
 from langchain.document_loaders import TextLoader
 from langchain.embeddings import BedrockEmbeddings
 from langchain.llms import Bedrock
@@ -7,14 +15,21 @@ from langchain.schema.runnable import RunnablePassthrough
 from langchain.text_splitter import RecursiveCharacterTextSplitter
 from langchain.vectorstores import Chroma
 
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "embedding-cache"))
+from embedding_cache import CachedEmbeddings, EmbeddingCache, SQLiteBackend
+
 embeddings_model_id = "amazon.titan-embed-text-v1"
 credentials_profile_name = "default"
 region_name = "us-east-1"
 
-bedrock_embedding = BedrockEmbeddings(
-    credentials_profile_name=credentials_profile_name,
-    region_name=region_name,
-    model_id=embeddings_model_id
+# Repeated DDL chunks and questions are answered from a local cache instead of calling Titan again
+bedrock_embedding = CachedEmbeddings(
+    BedrockEmbeddings(
+        credentials_profile_name=credentials_profile_name,
+        region_name=region_name,
+        model_id=embeddings_model_id
+    ),
+    EmbeddingCache(SQLiteBackend("embedding_cache.db"))
 )
 
 anthropic_claude_llm = Bedrock(
@@ -70,22 +85,39 @@ custom_prompt_template = PromptTemplate(
     input_variables=["context", "question"], template=TEMPLATE
 )
 
-# Load the DDL document and split it into chunks
-loader = TextLoader("northwind_ddl.sql")
-documents = loader.load()
+DDL_FILE = "northwind_ddl.sql"
+CHROMA_DIR = "chroma_db"
 
-# Split document into chunks
-text_splitter = RecursiveCharacterTextSplitter(
-    chunk_size=1000, chunk_overlap=0, separators=[" ", ",", "\n"]
-)
-docs = text_splitter.split_documents(documents)
 
-# Load the embeddings into Chroma in-memory vector store
-vectorstore = Chroma.from_documents(docs, embedding=bedrock_embedding)
+def ddl_collection_name(ddl_file):
+    with open(ddl_file, "rb") as f:
+        return "northwind_ddl_" + hashlib.sha256(f.read()).hexdigest()[:16]
+
+
+def load_vectorstore():
+    # The collection name carries the DDL hash, so the DDL is only split and embedded again when it changes
+    vectorstore = Chroma(
+        collection_name=ddl_collection_name(DDL_FILE),
+        embedding_function=bedrock_embedding,
+        persist_directory=CHROMA_DIR
+    )
+    if vectorstore._collection.count() == 0:
+        # Load the DDL document and split it into chunks
+        documents = TextLoader(DDL_FILE).load()
+        text_splitter = RecursiveCharacterTextSplitter(
+            chunk_size=1000, chunk_overlap=0, separators=[" ", ",", "\n"]
+        )
+        vectorstore.add_documents(text_splitter.split_documents(documents))
+        vectorstore.persist()
+    return vectorstore
+
+
+vectorstore = load_vectorstore()
 vectorstore_retriever = vectorstore.as_retriever(search_kwargs={"k": 1})
 
 model = anthropic_claude_llm
 prompt = ChatPromptTemplate.from_template(TEMPLATE)
+# Built once at import and shared by every session, runnables are stateless
 chain = (
     {
         "context": vectorstore_retriever,
@@ -97,14 +129,96 @@ chain = (
 )
 
 
+class QuestionCache:
+    """
+    LRU cache from question to generated SQL.
+
+    A question matches a cached one when the normalized text is identical, or when the cosine similarity of
+    their embeddings is at least similarity_threshold and both have the same numbers and quoted literals:
+    "top 5 products" and "top 10 products" are very close in embedding space but need different SQL.
+    Values written in words ("top five") or left unquoted ("customers in Germany") are not compared, keep the
+    threshold high.
+    """
+
+    # numbers, and literals in double quotes or in single quotes that are not apostrophes
+    _LITERAL = re.compile(r"""\d+(?:[.,]\d+)*|"[^"]*"|(?<!\w)'[^']*'(?!\w)""")
+
+    def __init__(self, embeddings, max_entries=256, similarity_threshold=0.97):
+        self.embeddings = embeddings
+        self.max_entries = max_entries
+        self.similarity_threshold = similarity_threshold
+        self._entries = OrderedDict()  # normalized question -> (unit embedding, literals, response)
+        self._lock = threading.Lock()
+        self.hits = 0
+        self.semantic_hits = 0
+        self.misses = 0
+
+    @staticmethod
+    def _normalize(question):
+        return " ".join(question.lower().split()).rstrip("?.! ")
+
+    @classmethod
+    def _literals(cls, question):
+        return tuple(cls._LITERAL.findall(question))
+
+    def _unit_embedding(self, question):
+        vector = self.embeddings.embed_query(question)
+        norm = math.sqrt(sum(v * v for v in vector)) or 1.0
+        return [v / norm for v in vector]
+
+    def get(self, question):
+        key = self._normalize(question)
+        with self._lock:
+            if key in self._entries:
+                self._entries.move_to_end(key)
+                self.hits += 1
+                return self._entries[key][2]
+        query_vector = self._unit_embedding(question)
+        literals = self._literals(question)
+        with self._lock:
+            best_key, best_score = None, self.similarity_threshold
+            for cached_key, (vector, cached_literals, _) in self._entries.items():
+                if cached_literals != literals:
+                    continue
+                score = sum(a * b for a, b in zip(query_vector, vector))
+                if score >= best_score:
+                    best_key, best_score = cached_key, score
+            if best_key is not None:
+                self._entries.move_to_end(best_key)
+                self.hits += 1
+                self.semantic_hits += 1
+                return self._entries[best_key][2]
+            self.misses += 1
+        return None
+
+    def put(self, question, response):
+        vector = self._unit_embedding(question)
+        with self._lock:
+            self._entries[self._normalize(question)] = (vector, self._literals(question), response)
+            self._entries.move_to_end(self._normalize(question))
+            while len(self._entries) > self.max_entries:
+                self._entries.popitem(last=False)
+
+
+question_cache = QuestionCache(bedrock_embedding)
+
+
 def sql_chain(question):
-    chain = (
-        {
-            "context": vectorstore_retriever,
-            "question": RunnablePassthrough()
-        }
-        | prompt
-        | model
-        | StrOutputParser()
-    )
-    return chain.invoke(question)
+    response = question_cache.get(question)
+    if response is None:
+        response = chain.invoke(question)
+        question_cache.put(question, response)
+    return response
+
+
+def sql_chain_stream(question):
+    """Like sql_chain but yields the response as the model generates it, cached responses come back in one piece."""
+    response = question_cache.get(question)
+    if response is not None:
+        yield response
+        return
+    chunks = []
+    for chunk in chain.stream(question):
+        chunks.append(chunk)
+        yield chunk
+    question_cache.put(question, "".join(chunks))
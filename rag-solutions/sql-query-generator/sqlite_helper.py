@@ -1,16 +1,276 @@
+import re
+import queue
 import sqlite3
+import threading
+import time
+from contextlib import contextmanager
 
+DB_FILE = "northwind.db"
+POOL_SIZE = 8
+QUERY_TIMEOUT_SECONDS = 10
+MAX_ROWS = 10_000
+MMAP_SIZE = 256 * 1024 * 1024  # large enough to map all of northwind.db
+CACHED_STATEMENTS = 256  # per connection, repeated queries skip parsing and planning
+BATCH_ROWS = 10_000  # rows per Arrow record batch when streaming results
+MAX_RESULT_BYTES = 64 * 1024 * 1024  # Arrow bytes a single streamed result may hold
 
-def run_query(query):
-    db_file = "northwind.db"
-    conn = None
+
+class QueryTimeout(Exception):
+    pass
+
+
+class ReadOnlyConnectionPool:
+    """
+    A fixed set of read-only connections shared by all Streamlit sessions.
+
+    Connections are opened once with the schema already parsed and reused, so a query pays neither the
+    connect cost nor lock contention with other sessions: with immutable=True SQLite skips file locking
+    and change detection entirely, which is safe as long as nothing writes to the database file while the
+    app runs. Use immutable=False if the database is updated in place (e.g. in WAL mode by another process).
+    """
+
+    def __init__(self, db_file=DB_FILE, size=POOL_SIZE, immutable=True, mmap_size=MMAP_SIZE,
+                 cached_statements=CACHED_STATEMENTS):
+        self.db_file = db_file
+        self._pool = queue.Queue()
+        uri = f"file:{db_file}?mode=ro" + ("&immutable=1" if immutable else "")
+        for _ in range(size):
+            conn = sqlite3.connect(uri, uri=True, check_same_thread=False, cached_statements=cached_statements)
+            conn.execute(f"PRAGMA mmap_size={int(mmap_size)}")
+            conn.execute("PRAGMA query_only=1")
+            conn.execute("SELECT count(*) FROM sqlite_master").fetchone()  # parse the schema now, not on the first query
+            self._pool.put(conn)
+
+    @contextmanager
+    def connection(self):
+        conn = self._pool.get()
+        try:
+            yield conn
+        finally:
+            conn.set_progress_handler(None, 0)
+            self._pool.put(conn)
+
+    def execute(self, query, params=(), timeout=QUERY_TIMEOUT_SECONDS, max_rows=MAX_ROWS):
+        """Returns (column_names, rows, truncated), raises QueryTimeout when the query runs past timeout seconds."""
+        with self.connection() as conn:
+            deadline = time.monotonic() + timeout
+            # called every 10k VM instructions, a non-zero return value interrupts the running statement
+            conn.set_progress_handler(lambda: int(time.monotonic() > deadline), 10_000)
+            try:
+                cur = conn.execute(query, params)
+                column_names = [col[0] for col in cur.description] if cur.description else []
+                rows = cur.fetchmany(max_rows + 1)
+                cur.close()
+            except sqlite3.OperationalError as e:
+                if time.monotonic() > deadline and "interrupted" in str(e):
+                    raise QueryTimeout(f"query exceeded {timeout}s") from e
+                raise
+            return column_names, rows[:max_rows], len(rows) > max_rows
+
+    def stream(self, query, params=(), limit=None, offset=0, batch_rows=BATCH_ROWS, timeout=QUERY_TIMEOUT_SECONDS,
+               max_bytes=MAX_RESULT_BYTES):
+        return ResultStream(self, query, params, limit, offset, batch_rows, timeout, max_bytes)
+
+
+# string literals, quoted identifiers and comments, which may contain anything that looks like SQL
+_QUOTED = re.compile(r"'(?:[^']|'')*'|\"(?:[^\"]|\"\")*\"|`[^`]*`|\[[^\]]*\]|--[^\n]*|/\*.*?\*/", re.DOTALL)
+
+
+def _top_level(body):
+    """The text of body outside quotes, comments and parentheses, where a LIMIT applies to the whole statement."""
+    depth, outside = 0, []
+    for part in re.split(r"([()])", _QUOTED.sub(" ", body)):
+        if part == "(":
+            depth += 1
+        elif part == ")":
+            depth -= 1
+        elif depth == 0:
+            outside.append(part)
+    return " ".join(outside)
+
+
+def limit_query(query, limit, offset=0):
+    """
+    Limits a single SELECT (or WITH ... SELECT) statement so SQLite only produces one page of its rows.
+
+    Returns (query, params), other statements come back unchanged and are bounded by max_bytes instead.
+    LIMIT and OFFSET are appended to the statement, after its ORDER BY. A statement with a LIMIT of its own is
+    wrapped in a subquery instead, so that the page is taken from the rows its LIMIT keeps.
+    """
+    body = query.strip().rstrip(";").strip()
+    top_level = _top_level(body)
+    if ";" in top_level or not re.match(r"(SELECT|WITH)\b", body, re.IGNORECASE):
+        return query, ()
+    if re.search(r"\bLIMIT\b", top_level, re.IGNORECASE):
+        return f"SELECT * FROM ({body}\n) LIMIT ? OFFSET ?", (int(limit), int(offset))
+    # on a line of its own, the statement may end with a -- comment
+    return f"{body}\nLIMIT ? OFFSET ?", (int(limit), int(offset))
+
+
+def extract_query(ai_response, complete=True):
+    r"""
+    The statement after SQLQuery: in a model response, up to its first ; or blank line outside quotes ("Order Details"
+    is a table). A statement the model put in double quotes ends at the closing quote.
+    While streaming (complete=False) it is only returned once one of them has arrived, so the query can start early.
+    Returns the statement terminated with ;, or "" when there is none.
+
+    Checked with python -m doctest sqlite_helper.py:
+
+    >>> extract_query("SQLQuery: SELECT * FROM \"Order Details\" WHERE a = 'x;y';\nSQLResult:", complete=False)
+    'SELECT * FROM "Order Details" WHERE a = \'x;y\';'
+    >>> extract_query('SQLQuery: "SELECT ProductName FROM Products LIMIT 5"\n\nThis returns the top 5.')
+    'SELECT ProductName FROM Products LIMIT 5;'
+    >>> extract_query('SQLQuery: "SELECT * FROM "Order Details""')
+    'SELECT * FROM "Order Details";'
+    >>> extract_query('SQLQuery: "SELECT 1', complete=False)
+    ''
+    >>> extract_query('SQLQuery: SELECT a\nFROM b\n\nExplanation: ...', complete=False)
+    'SELECT a\nFROM b;'
+    """
+    match = re.search(r'\bSQLQuery:\s*', ai_response, re.IGNORECASE)
+    if not match:
+        return ""
+    text = ai_response[match.end():]
+    # the model sometimes puts the whole statement in double quotes
+    wrapped = re.match(r'"\s*(SELECT|WITH)\b', text, re.IGNORECASE) is not None
+    if wrapped:
+        text = text[1:]
+    quote = None
+    for i, char in enumerate(text):
+        if quote:
+            if char == quote:
+                quote = None
+        elif wrapped and char == '"' and re.match(r'"(\s|;|$)', text[i:i + 2]):
+            # a quoted identifier starts with a name, the closing wrapper is followed by the end of the statement
+            text = text[:i]
+            break
+        elif char in "'\"":
+            quote = char
+        elif char == ";" or (char == "\n" and re.match(r'\n[ \t]*\n', text[i:i + 80])):
+            text = text[:i]
+            break
+    else:
+        if not complete:
+            return ""
+    statement = text.strip()
+    return statement + ";" if statement else ""
+
+
+class ResultStream:
+    """
+    Iterates over the result of a query as pyarrow.RecordBatch objects of up to batch_rows rows.
+
+    Rows are fetched from the cursor one batch at a time, so memory is bounded by a batch and not by the
+    result size. Iteration stops early, with truncated set, once the batches produced so far hold more than
+    max_bytes. The pooled connection is held until the stream is exhausted or closed, so use it as a context
+    manager or iterate it to the end. The timeout counts from the start of the query to the last batch.
+
+    SQLite columns are dynamically typed: the Arrow type of a column is taken from the first batch with a
+    non-null value, a later batch whose values do not fit that type gets the column as strings.
+    """
+
+    def __init__(self, pool, query, params=(), limit=None, offset=0, batch_rows=BATCH_ROWS,
+                 timeout=QUERY_TIMEOUT_SECONDS, max_bytes=MAX_RESULT_BYTES):
+        limit_params = ()
+        if limit is not None:
+            query, limit_params = limit_query(query, limit, offset)
+            params = tuple(params) + limit_params
+        self.limited = bool(limit_params)  # whether limit and offset were applied to the query
+        self.pool = pool
+        self.query = query
+        self.params = params
+        self.batch_rows = batch_rows
+        self.timeout = timeout
+        self.max_bytes = max_bytes
+        self.column_names = []
+        self.rows = 0
+        self.nbytes = 0
+        self.truncated = False
+        self._types = {}
+        self._batches = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __iter__(self):
+        if self._batches is None:
+            self._batches = self._generate()
+        return self._batches
+
+    def close(self):
+        if self._batches is not None:
+            self._batches.close()
+
+    def _to_array(self, i, values):
+        import pyarrow as pa
+        arrow_type = self._types.get(i)
+        try:
+            array = pa.array(values, type=arrow_type)
+        except (pa.ArrowInvalid, pa.ArrowTypeError):
+            array = pa.array([None if v is None else str(v) for v in values], type=pa.string())
+        if arrow_type is None and not pa.types.is_null(array.type):
+            self._types[i] = array.type
+        return array
+
+    def _generate(self):
+        import pyarrow as pa
+        with self.pool.connection() as conn:
+            deadline = time.monotonic() + self.timeout
+            conn.set_progress_handler(lambda: int(time.monotonic() > deadline), 10_000)
+            try:
+                cur = conn.execute(self.query, self.params)
+                self.column_names = [col[0] for col in cur.description] if cur.description else []
+                try:
+                    while True:
+                        rows = cur.fetchmany(self.batch_rows)
+                        if not rows:
+                            return
+                        columns = zip(*rows)
+                        batch = pa.RecordBatch.from_arrays([self._to_array(i, list(values)) for i, values in enumerate(columns)],
+                                                           names=self.column_names)
+                        del rows, columns
+                        self.rows += batch.num_rows
+                        self.nbytes += batch.nbytes
+                        yield batch
+                        if self.nbytes >= self.max_bytes:
+                            self.truncated = cur.fetchone() is not None
+                            return
+                finally:
+                    cur.close()
+            except sqlite3.OperationalError as e:
+                if time.monotonic() > deadline and "interrupted" in str(e):
+                    raise QueryTimeout(f"query exceeded {self.timeout}s") from e
+                raise
+
+
+_pool = None
+_pool_lock = threading.Lock()
+
+
+def get_pool():
+    global _pool
+    if _pool is None:
+        with _pool_lock:
+            if _pool is None:
+                _pool = ReadOnlyConnectionPool()
+    return _pool
+
+
+def run_query(query, timeout=QUERY_TIMEOUT_SECONDS, max_rows=MAX_ROWS):
+    """Returns ("success", column_names, rows, truncated) with truncated set past max_rows, or ("fail", "", error, False)."""
     try:
-        conn = sqlite3.connect(db_file)
-        with conn:
-            cur = conn.cursor()
-            cur.execute(query)
-            column_names = [col[0] for col in cur.description]
-            return "success", column_names, cur.fetchall()
+        column_names, rows, truncated = get_pool().execute(query, timeout=timeout, max_rows=max_rows)
+        return "success", column_names, rows, truncated
 
     except Exception as e:
-        return "fail", "", str(e)
+        return "fail", "", str(e), False
+
+
+def stream_query(query, limit=None, offset=0, batch_rows=BATCH_ROWS, timeout=QUERY_TIMEOUT_SECONDS,
+                 max_bytes=MAX_RESULT_BYTES):
+    """Streams the result of query as Arrow record batches from the shared pool, see ResultStream."""
+    return get_pool().stream(query, limit=limit, offset=offset, batch_rows=batch_rows, timeout=timeout,
+                             max_bytes=max_bytes)